@@ -0,0 +1,189 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  An adaptive mutex: on contention it first spins for a while (with
+  exponential backoff), on the theory that most critical sections are
+  short and the lock will be free again before it's worth going to
+  sleep, and only then sleeps on a futex.  pthread mutexes go to sleep
+  right away, which costs two system calls and a context switch or
+  two per contended acquisition even when the holder was about to let
+  go.  On a single-CPU machine there's no point in spinning, so we
+  don't.  Uncontended lock and unlock are a single atomic instruction
+  each.
+
+  The lock word follows Drepper's "Futexes Are Tricky": 0 is
+  unlocked, 1 is locked, 2 is locked and somebody may be asleep, so
+  unlock only makes a system call if it might need to wake somebody.
+
+  Give a mutex a name and it keeps statistics on itself: how many
+  times it was acquired, how many of those were contended (had to
+  wait), and histograms of how long acquirers waited and how long the
+  lock was held, in power-of-two nanosecond buckets.  All named
+  mutexes are kept in a registry, which adaptive_mutex::dump_stats()
+  prints, so you can find out which locks in a program are hot.
+  Profiling costs a couple of clock_gettime() calls per acquisition;
+  unnamed mutexes skip it entirely.  The statistics are updated while
+  the lock is held, so they're only approximate if you read them
+  while other threads are using the lock.
+
+  Use adaptive_locker to hold one, just like locker (locker.hpp).
+  Named mutexes should outlive any call to dump_stats() that might
+  see them, and unlike pthread mutexes, these aren't recursive and
+  don't detect errors like unlocking a mutex you don't hold.
+
+  The statistics and registry live in src/adaptive_mutex.cpp.
+*/
+
+#ifndef _KRB_ADAPTIVE_MUTEX_HPP
+#define _KRB_ADAPTIVE_MUTEX_HPP
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <krb/atomic_ops.hpp>
+#include <krb/futex.hpp>
+
+// a histogram of times in power-of-two nanosecond buckets: bucket i
+// counts times in [2^i, 2^(i+1)) ns (bucket 0 also gets 0 ns)
+struct lock_histogram
+{
+  static const uint32_t n_buckets = 40;
+  uint64_t buckets[n_buckets];
+
+  lock_histogram() { clear(); }
+  void clear();
+  void add(uint64_t ns);
+  uint64_t count() const;
+
+  // approximate p-th percentile (p in [0,1]): the upper edge of the
+  // bucket it falls in
+  uint64_t percentile(double p) const;
+};
+
+struct lock_stats
+{
+  uint64_t acquisitions, contended;
+  lock_histogram wait_ns, hold_ns;
+
+  lock_stats() : acquisitions(0), contended(0) {}
+};
+
+
+class adaptive_mutex
+{
+public:
+
+  // a name turns on profiling.  spin_limit bounds the number of
+  // cpu_relax() calls we'll make before sleeping.
+  adaptive_mutex(const char *name = NULL, uint32_t spin_limit = 1000);
+  ~adaptive_mutex();
+
+  void lock()
+  {
+    if(__sync_val_compare_and_swap(&state, 0, 1) != 0)
+      lock_contended();
+    else if(stats)
+      acquired(0, false);
+  }
+
+  bool try_lock()
+  {
+    if(__sync_val_compare_and_swap(&state, 0, 1) != 0)
+      return false;
+    if(stats)
+      acquired(0, false);
+    return true;
+  }
+
+  void unlock()
+  {
+    if(stats)
+      releasing();
+
+    // if there might be sleepers (state was 2), wake one up
+    if(__sync_fetch_and_sub(&state, 1) != 1) {
+      store_release(&state, (uint32_t)0);
+      futex_wake(&state, 1);
+    }
+  }
+
+  const std::string & name() const { return lock_name; }
+
+  // copy of this mutex's statistics (all zero if it isn't named)
+  lock_stats get_stats() const;
+  void reset_stats();
+
+  // print statistics for every named mutex
+  static void dump_stats(FILE *out);
+
+protected:
+
+  adaptive_mutex(const adaptive_mutex &);             // no copying
+  adaptive_mutex & operator=(const adaptive_mutex &);
+
+  void lock_contended();
+
+  // profiling hooks, called with the lock held
+  void acquired(uint64_t wait_start, bool contended);
+  void releasing();
+
+  static uint64_t now_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  volatile uint32_t state; // 0 unlocked, 1 locked, 2 locked with waiters
+  uint32_t spin_limit;
+  std::string lock_name;
+  lock_stats *stats;
+  uint64_t hold_start;
+};
+
+
+class adaptive_locker
+{
+public:
+
+  adaptive_locker(adaptive_mutex &mutex)
+    : M(mutex)
+  {
+    M.lock();
+  }
+
+  ~adaptive_locker()
+  {
+    M.unlock();
+  }
+
+protected:
+  adaptive_mutex &M;
+
+};
+
+#endif // _KRB_ADAPTIVE_MUTEX_HPP
@@ -48,6 +48,13 @@
        const apache_log_entry &e);
 
   If the function returns false, log playback is terminated.
+
+  The sorting buffer is a multimap that inserts and erases one node
+  per log line.  To choose its allocator (pool_allocator, say, from
+  pool_allocator.hpp), use basic_apache_log_playback<Alloc> in place
+  of apache_log_playback; the Alloc template argument is rebound for
+  the multimap's nodes, as in lru_cache_t.  Callbacks see either one
+  as an apache_log_playback.
 */
 
 #ifndef _KRB_APACHE_LOG_PLAYBACK_HPP
@@ -55,6 +62,8 @@
 
 #include <istream>
 #include <map>
+#include <memory>
+#include <functional>
 #include <krb/apache_log_entry.hpp>
 
 class apache_log_playback; // forward declaration
@@ -74,6 +83,7 @@ public:
   apache_log_playback
     (std::istream &input, apache_log_callback &callback,
      uint32_t buffered_entries = 0, double speed = 0.0);
+  virtual ~apache_log_playback();
 
   // read a single log entry and call the callback; returns false if
   // the log is finished or there is some kind of failure.  may sleep
@@ -88,20 +98,76 @@ public:
 
 protected:
 
+  // the sorting buffer, behind an interface so that the allocator can
+  // be a template argument (see basic_apache_log_playback below)
+  // without the rest of the class being a template
+  struct entry_buffer
+  {
+    virtual ~entry_buffer() {}
+    virtual void insert(const apache_log_entry &e) = 0;
+    virtual uint32_t size() const = 0;
+
+    // remove the earliest entry, copying it into e
+    virtual void pop(apache_log_entry &e) = 0;
+  };
+
+  template <class Alloc>
+  struct multimap_buffer : public entry_buffer
+  {
+    typedef std::pair<const time_t, apache_log_entry> value_type;
+    typedef std::multimap
+      <time_t, apache_log_entry, std::less<time_t>,
+       typename Alloc::template rebind<value_type>::other> map_type;
+
+    map_type entries;
+
+    void insert(const apache_log_entry &e)
+    {
+      entries.insert(value_type(e.time(), e));
+    }
+
+    uint32_t size() const { return entries.size(); }
+
+    void pop(apache_log_entry &e)
+    {
+      e = entries.begin()->second;
+      entries.erase(entries.begin());
+    }
+  };
+
+  // for basic_apache_log_playback; we take ownership of buf
+  apache_log_playback
+    (std::istream &input, apache_log_callback &callback,
+     uint32_t buffered_entries, double speed, entry_buffer *buf);
+
+  apache_log_playback(const apache_log_playback &); // no copying
+  apache_log_playback & operator=(const apache_log_playback &);
+
   std::istream &is;
   apache_log_callback &cb;
 
   uint32_t buf_size;
   double speed_mult;
 
-  typedef std::multimap<time_t, apache_log_entry> buf_type;
-  typedef std::pair<time_t, apache_log_entry> buf_inserter;
-  typedef buf_type::iterator buf_iterator;
-
-  buf_type buffer;
+  entry_buffer *buffer;
   uint32_t line_no;
   time_t last_entry_time;
   int32_t delay_usec;
 };
 
+// apache_log_playback with the sorting buffer's allocator chosen by
+// the Alloc template argument
+template <class Alloc = std::allocator<apache_log_entry> >
+class basic_apache_log_playback : public apache_log_playback
+{
+public:
+
+  basic_apache_log_playback
+    (std::istream &input, apache_log_callback &callback,
+     uint32_t buffered_entries = 0, double speed = 0.0)
+      : apache_log_playback(input, callback, buffered_entries, speed,
+                            new multimap_buffer<Alloc>)
+  {}
+};
+
 #endif // _KRB_APACHE_LOG_PLAYBACK_HPP
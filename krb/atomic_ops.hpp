@@ -0,0 +1,135 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A handful of low-level atomic helpers used by the lock-free and
+  multithreaded pieces of the library.  Read-modify-write operations
+  are done with the GCC __sync builtins directly; this header just
+  fills in the things __sync doesn't give us: ordered loads and
+  stores, compiler barriers, and a polite spin-wait hint.
+
+  If the compiler supports the newer __atomic builtins (GCC 4.7 and
+  up) we use them for acquire/release loads and stores.  Otherwise we
+  fall back to volatile accesses bracketed with full barriers, which
+  is slower but correct.
+*/
+
+#ifndef _KRB_ATOMIC_OPS_HPP
+#define _KRB_ATOMIC_OPS_HPP
+
+#include <inttypes.h>
+
+// size we assume for a cache line when padding shared data to avoid
+// false sharing
+#define KRB_CACHE_LINE 64
+
+// keep the compiler from reordering memory accesses across this
+// point (says nothing about the hardware)
+inline void compiler_barrier()
+{
+  __asm__ __volatile__("" ::: "memory");
+}
+
+// full hardware memory barrier
+inline void full_barrier()
+{
+  __sync_synchronize();
+}
+
+// hint to the cpu that we're in a spin-wait loop
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause" ::: "memory");
+#else
+  compiler_barrier();
+#endif
+}
+
+template <class T>
+inline T load_relaxed(const volatile T *p)
+{
+#ifdef __ATOMIC_RELAXED
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+#else
+  return *p;
+#endif
+}
+
+template <class T>
+inline void store_relaxed(volatile T *p, T v)
+{
+#ifdef __ATOMIC_RELAXED
+  __atomic_store_n(p, v, __ATOMIC_RELAXED);
+#else
+  *p = v;
+#endif
+}
+
+template <class T>
+inline T load_acquire(const volatile T *p)
+{
+#ifdef __ATOMIC_ACQUIRE
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+  T v = *p;
+  __sync_synchronize();
+  return v;
+#endif
+}
+
+template <class T>
+inline void store_release(volatile T *p, T v)
+{
+#ifdef __ATOMIC_RELEASE
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#else
+  __sync_synchronize();
+  *p = v;
+#endif
+}
+
+// fences: loads before an acquire fence are ordered before any loads
+// or stores after it; stores after a release fence are ordered after
+// any loads or stores before it
+inline void acquire_fence()
+{
+#ifdef __ATOMIC_ACQUIRE
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#else
+  __sync_synchronize();
+#endif
+}
+
+inline void release_fence()
+{
+#ifdef __ATOMIC_RELEASE
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+#else
+  __sync_synchronize();
+#endif
+}
+
+#endif // _KRB_ATOMIC_OPS_HPP
@@ -0,0 +1,248 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A "big reader" lock: a reader-writer lock for data that's read
+  constantly and written rarely.  A pthread_rwlock keeps one count of
+  readers, so every reader on every core writes to the same cache
+  line, which ends up bouncing between cores and limiting read
+  throughput no matter how short the read-side critical sections are.
+  brlock instead keeps a separate reader count for each of a number of
+  slots, each on its own cache line, and each thread always uses the
+  same slot; readers only ever write to their own slot's line, so
+  read-side cost stays flat as cores are added.  The price is paid by
+  writers, which have to sweep every slot waiting for readers to drain.
+
+  Writers take priority: once a writer has announced itself, new
+  readers wait for it to finish (sleeping on a futex if it takes a
+  while), and the writer waits for the readers already inside to
+  leave.  So, as with a writer-preferring rwlock, a thread must not
+  take the read lock recursively.
+
+  The number of slots defaults to the number of CPUs, rounded up to a
+  power of two.  Threads are assigned slots round-robin the first time
+  they take any brlock.
+
+  Use the br_read_locker and br_write_locker objects, which work just
+  like read_locker and write_locker in locker.hpp.
+*/
+
+#ifndef _KRB_BRLOCK_HPP
+#define _KRB_BRLOCK_HPP
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <new>
+#include <krb/atomic_ops.hpp>
+#include <krb/futex.hpp>
+#include <krb/locker.hpp>
+
+class brlock
+{
+public:
+
+  // slots is rounded up to a power of two; 0 means one per CPU
+  brlock(uint32_t slots = 0);
+  ~brlock();
+
+  // read_lock returns the slot used, which must be passed back to
+  // read_unlock
+  uint32_t read_lock();
+  void read_unlock(uint32_t slot);
+
+  void write_lock();
+  void write_unlock();
+
+  uint32_t slots() const { return n_slots; }
+
+protected:
+
+  brlock(const brlock &);             // no copying
+  brlock & operator=(const brlock &);
+
+  // the calling thread's slot number (not yet masked)
+  static uint32_t thread_slot()
+  {
+    static __thread uint32_t slot = 0; // index+1, or 0 if unassigned
+    static volatile uint32_t next_slot = 0;
+    if(!slot)
+      slot = __sync_add_and_fetch(&next_slot, 1);
+    return slot - 1;
+  }
+
+  struct reader_slot
+  {
+    volatile uint32_t readers;
+    char pad[KRB_CACHE_LINE - sizeof(uint32_t)];
+  };
+
+  reader_slot *reader_slots;
+  uint32_t n_slots, mask;
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint32_t writer; // nonzero while a writer holds or wants the lock
+  char pad1[KRB_CACHE_LINE];
+
+  pthread_mutex_t write_mutex; // serializes writers
+};
+
+
+class br_read_locker
+{
+public:
+
+  br_read_locker(brlock &lock)
+    : L(lock), slot(lock.read_lock()) {}
+
+  ~br_read_locker()
+  {
+    L.read_unlock(slot);
+  }
+
+protected:
+  brlock &L;
+  uint32_t slot;
+
+};
+
+
+class br_write_locker
+{
+public:
+
+  br_write_locker(brlock &lock)
+    : L(lock)
+  {
+    L.write_lock();
+  }
+
+  ~br_write_locker()
+  {
+    L.write_unlock();
+  }
+
+protected:
+  brlock &L;
+
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+inline brlock::brlock(uint32_t slots)
+  : writer(0)
+{
+  if(slots == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    slots = cpus > 0 ? cpus : 1;
+  }
+  n_slots = 1;
+  while(n_slots < slots)
+    n_slots <<= 1;
+  mask = n_slots - 1;
+
+  // each slot gets a cache line to itself
+  void *mem;
+  if(posix_memalign(&mem, KRB_CACHE_LINE, n_slots * sizeof(reader_slot)))
+    throw std::bad_alloc();
+  reader_slots = (reader_slot *)mem;
+  for(uint32_t i = 0; i < n_slots; ++i)
+    reader_slots[i].readers = 0;
+
+  pthread_mutex_init(&write_mutex, NULL);
+}
+
+inline brlock::~brlock()
+{
+  pthread_mutex_destroy(&write_mutex);
+  free(reader_slots);
+}
+
+inline uint32_t brlock::read_lock()
+{
+  const uint32_t slot = thread_slot() & mask;
+  volatile uint32_t *readers = &reader_slots[slot].readers;
+
+  while(1) {
+    // announce ourselves (this is a full barrier), then make sure no
+    // writer got in first
+    __sync_fetch_and_add(readers, 1);
+    if(!load_relaxed(&writer))
+      return slot;
+
+    // a writer is active or waiting; back out and wait for it
+    __sync_fetch_and_sub(readers, 1);
+    for(uint32_t spins = 0; load_acquire(&writer); ++spins) {
+      if(spins < 100)
+        cpu_relax();
+      else
+        futex_wait(&writer, 1);
+    }
+  }
+}
+
+inline void brlock::read_unlock(uint32_t slot)
+{
+  __sync_fetch_and_sub(&reader_slots[slot].readers, 1);
+}
+
+inline void brlock::write_lock()
+{
+  int rv = pthread_mutex_lock(&write_mutex);
+  if(rv != 0)
+    throw strerror_exception("Failed acquiring brlock", rv);
+
+  // keep new readers out, then wait for the ones inside to leave
+  store_relaxed(&writer, (uint32_t)1);
+  full_barrier();
+
+  for(uint32_t i = 0; i < n_slots; ++i) {
+    for(uint32_t spins = 0; load_acquire(&reader_slots[i].readers); ++spins) {
+      if(spins < 100)
+        cpu_relax();
+      else
+        sched_yield();
+    }
+  }
+}
+
+inline void brlock::write_unlock()
+{
+  store_release(&writer, (uint32_t)0);
+
+  // writes are rare, so don't bother keeping track of whether any
+  // readers are asleep
+  futex_wake(&writer);
+
+  pthread_mutex_unlock(&write_mutex);
+}
+
+#endif // _KRB_BRLOCK_HPP
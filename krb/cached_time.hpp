@@ -24,13 +24,23 @@
 */
 
 /*
-  Caching time_t/timeval thread.
-
-  The time cacher starts a separate thread which sleeps for a
-  sub-second interval between calls to time() and/or gettimeofday().
-  the accuracy of time() is essentially unaffected as long as the
-  sleep interval is small enough, but the resolution of gettimeofday()
-  is limited to the refresh interval.
+  Caching time_t/timeval/timespec thread.
+
+  The time cacher starts a separate thread which reads the clocks,
+  publishes a snapshot of them, and sleeps for a sub-second interval
+  before doing it again.  Reading the cached time is a lock-free copy
+  of the snapshot (through a seqlock; see seqlock.hpp) with no system
+  calls and no writes to shared memory, so any number of threads can
+  read it at once.  The accuracy of time() is essentially unaffected
+  as long as the interval is small enough, but the resolution of
+  everything else is limited to the refresh interval.
+
+  The clocks can be read precisely (CLOCK_REALTIME/CLOCK_MONOTONIC) or
+  with the kernel's coarse clocks (CLOCK_REALTIME_COARSE/
+  CLOCK_MONOTONIC_COARSE), which are cheaper to read and only as
+  precise as the scheduler tick, which is usually plenty for a cache
+  refreshed every few milliseconds.  If the coarse clocks aren't
+  available, the precise ones are used instead.
 
   This class can only be instantiated once.  To do so, call
   cached_time::init(), which returns a reference to the instantiation.
@@ -43,45 +53,68 @@
 #include <sys/time.h>
 #include <time.h>
 #include <pthread.h>
+#include <krb/seqlock.hpp>
 
 class cached_time
 {
 public:
 
-  // interval_ms should be less than 1000; gettimeofday()'s accuracy
-  // is limited by interval_ms --- you need to choose a tradeoff
-  // between the frequency at which you need the time and the accuracy
-  // you want.
-  static cached_time & init(uint32_t interval_ms = 500)
+  enum clock_source { precise_clock, coarse_clock };
+
+  // interval_ms should be less than 1000; the accuracy of everything
+  // but time() is limited by interval_ms --- you need to choose a
+  // tradeoff between the frequency at which you need the time and the
+  // accuracy you want.  the arguments only matter the first time
+  // init() is called.  throws strerror_exception if the refresh
+  // thread can't be started (and init() can be tried again later).
+  static cached_time & init(uint32_t interval_ms = 500,
+                            clock_source source = precise_clock)
   {
-    static cached_time singleton(interval_ms);
+    static cached_time singleton(interval_ms, source);
     return singleton;
   }
 
   ~cached_time();
 
   // analogous to calling libc time(NULL)
-  time_t time();
+  time_t time() const { return snapshot.load().t; }
 
   // analogous to calling libc gettimeofday(tv, NULL)
-  int gettimeofday(struct timeval *tv);
+  int gettimeofday(struct timeval *tv) const
+  {
+    *tv = snapshot.load().tv;
+    return 0;
+  }
+
+  // analogous to calling clock_gettime(CLOCK_REALTIME, ts) and
+  // clock_gettime(CLOCK_MONOTONIC, ts)
+  void realtime(struct timespec *ts) const { *ts = snapshot.load().real; }
+  void monotonic(struct timespec *ts) const { *ts = snapshot.load().mono; }
+
+  clock_source source() const { return src; }
 
 protected:
 
-  cached_time(uint32_t interval_ms); // private constructor
+  cached_time(uint32_t interval_ms, clock_source source); // private
   cached_time(const cached_time &);  // no copy construction
   cached_time & operator=(const cached_time &); // no assignment
 
+  // read the clocks and publish a new snapshot
+  void refresh();
+
+  struct times
+  {
+    struct timespec real, mono;
+    struct timeval tv;
+    time_t t;
+  };
+
   uint32_t interval_usec;
-  pthread_mutex_t renew_mutex;
-  pthread_cond_t renew_cond;
+  clock_source src;
+  clockid_t real_clock, mono_clock;
   pthread_t tid;
 
-  time_t c_time;
-  struct timeval c_gettimeofday;
-  int c_gettimeofday_rv;
-
-  bool stale_time, stale_gettimeofday;
+  seqlock<times> snapshot;
 
   friend void * cached_time_processor(void *arg);
 
@@ -0,0 +1,359 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Epoch-based memory reclamation, for lock-free and RCU-style
+  structures that unlink something while other threads may still be
+  looking at it.  Instead of freeing it right away, the unlinking
+  thread retire()s it, and it's freed once every thread that could
+  possibly have seen it has moved on.
+
+  Threads that touch the shared structure register with an
+  epoch_domain, and do their accesses inside critical sections
+  (epoch_guard, or enter()/exit()).  Entering costs a thread-local
+  store of the current global epoch and a fence; leaving is a single
+  store.  The global epoch only advances once every thread inside a
+  critical section has entered during the current epoch, so anything
+  retired in epoch e can no longer be referenced once the global epoch
+  reaches e+2.  Each thread keeps three limbo lists of retired
+  pointers, one per epoch mod 3, and frees a list when it comes around
+  again.  Reclamation is batched: every so many retire()s (see the
+  constructor), the retiring thread tries to advance the epoch and
+  frees what it can.
+
+  A thread that never leaves its critical section holds up
+  reclamation for everybody, so keep them short and don't block inside
+  them.  Critical sections may nest.  A participant handle belongs to
+  the thread that registered it; when a thread unregisters, its
+  remaining limbo lists are handed over to the domain and freed later.
+  Anything still retired when the domain is destroyed is freed then,
+  so the domain should outlive the structures that use it.
+
+    epoch_domain D;
+
+    // in each thread
+    epoch_domain::participant *me = D.register_thread();
+    {
+      epoch_guard G(D, me);
+      node *old = swap_out_something();
+      D.retire(me, old);             // deleted later with delete
+    }
+    D.unregister_thread(me);
+*/
+
+#ifndef _KRB_EPOCH_HPP
+#define _KRB_EPOCH_HPP
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/atomic_ops.hpp>
+#include <krb/locker.hpp>
+
+class epoch_domain
+{
+public:
+
+  typedef void (*deleter_type)(void *);
+
+  struct retired
+  {
+    void *ptr;
+    deleter_type deleter;
+  };
+
+  struct limbo_list
+  {
+    uint64_t epoch;                 // epoch these were retired in
+    std::vector<retired> items;
+  };
+
+  // one per registered thread; opaque to users
+  class participant
+  {
+  public:
+    participant() : epoch(0), in_use(1), next(NULL), nesting(0),
+      since_advance(0)
+    {
+      for(uint32_t i = 0; i < 3; ++i)
+        limbo[i].epoch = 0;
+    }
+
+  protected:
+    friend class epoch_domain;
+
+    // shared: the epoch this thread entered in, or 0 if it's outside
+    // any critical section
+    volatile uint64_t epoch;
+    volatile uint32_t in_use;
+    participant *next;
+
+    // private to the owning thread
+    char pad[KRB_CACHE_LINE];
+    uint32_t nesting, since_advance;
+    limbo_list limbo[3];
+    char pad2[KRB_CACHE_LINE];
+  };
+
+  // every advance_every retire()s, a thread tries to advance the epoch
+  // and free its old limbo lists
+  epoch_domain(uint32_t advance_every = 64);
+  ~epoch_domain();
+
+  participant * register_thread();
+  void unregister_thread(participant *p);
+
+  void enter(participant *p)
+  {
+    if(p->nesting++ == 0) {
+      store_relaxed(&p->epoch, load_relaxed(&global_epoch));
+      full_barrier(); // our epoch must be visible before we read anything
+    }
+  }
+
+  void exit(participant *p)
+  {
+    if(--p->nesting == 0)
+      store_release(&p->epoch, (uint64_t)0);
+  }
+
+  // free ptr with deleter once no critical section can still see it
+  void retire(participant *p, void *ptr, deleter_type deleter);
+
+  template <class T>
+  void retire(participant *p, T *ptr)
+  {
+    retire(p, (void *)ptr, &delete_object<T>);
+  }
+
+  // advance the epoch if every thread in a critical section has
+  // caught up with it; returns true if it moved
+  bool try_advance();
+
+  // try to advance, then free whatever p has retired that's now safe
+  void collect(participant *p);
+
+  uint64_t epoch() const { return load_relaxed(&global_epoch); }
+
+protected:
+
+  epoch_domain(const epoch_domain &);             // no copying
+  epoch_domain & operator=(const epoch_domain &);
+
+  template <class T>
+  static void delete_object(void *ptr) { delete (T *)ptr; }
+
+  static void free_list(limbo_list &l);
+  void reclaim(participant *p, uint64_t global);
+  void reclaim_orphans(uint64_t global);
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint64_t global_epoch;
+  char pad1[KRB_CACHE_LINE];
+
+  participant * volatile participants; // never shrinks until we die
+  uint32_t advance_every;
+
+  pthread_mutex_t orphan_mutex;
+  std::vector<limbo_list> orphans;
+  volatile uint32_t n_orphans; // orphans.size(), readable without the lock
+};
+
+
+// RAII critical section
+class epoch_guard
+{
+public:
+
+  epoch_guard(epoch_domain &domain, epoch_domain::participant *p)
+    : D(domain), P(p)
+  {
+    D.enter(P);
+  }
+
+  ~epoch_guard()
+  {
+    D.exit(P);
+  }
+
+protected:
+  epoch_domain &D;
+  epoch_domain::participant *P;
+
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+inline epoch_domain::epoch_domain(uint32_t advance)
+  : global_epoch(1), participants(NULL),
+    advance_every(advance ? advance : 1), n_orphans(0)
+{
+  pthread_mutex_init(&orphan_mutex, NULL);
+}
+
+inline epoch_domain::~epoch_domain()
+{
+  // nobody should be left, so everything is safe to free
+  participant *p = participants;
+  while(p) {
+    participant *next = p->next;
+    for(uint32_t i = 0; i < 3; ++i)
+      free_list(p->limbo[i]);
+    delete p;
+    p = next;
+  }
+
+  for(uint32_t i = 0; i < orphans.size(); ++i)
+    free_list(orphans[i]);
+
+  pthread_mutex_destroy(&orphan_mutex);
+}
+
+inline epoch_domain::participant * epoch_domain::register_thread()
+{
+  // reuse a participant some thread has given up, if there is one
+  for(participant *p = load_acquire(&participants); p; p = p->next)
+    if(load_relaxed(&p->in_use) == 0 &&
+       __sync_bool_compare_and_swap(&p->in_use, 0, 1))
+    {
+      return p;
+    }
+
+  participant *p = new participant, *head;
+  do {
+    head = load_relaxed(&participants);
+    p->next = head;
+  } while(!__sync_bool_compare_and_swap(&participants, head, p));
+
+  return p;
+}
+
+inline void epoch_domain::unregister_thread(participant *p)
+{
+  // hand our leftovers to the domain
+  {
+    locker L(orphan_mutex);
+    for(uint32_t i = 0; i < 3; ++i)
+      if(!p->limbo[i].items.empty()) {
+        orphans.push_back(limbo_list());
+        orphans.back().epoch = p->limbo[i].epoch;
+        orphans.back().items.swap(p->limbo[i].items);
+      }
+    store_release(&n_orphans, (uint32_t)orphans.size());
+  }
+
+  p->nesting = 0;
+  p->since_advance = 0;
+  store_release(&p->epoch, (uint64_t)0);
+  store_release(&p->in_use, (uint32_t)0);
+}
+
+inline void epoch_domain::free_list(limbo_list &l)
+{
+  for(uint32_t i = 0; i < l.items.size(); ++i)
+    l.items[i].deleter(l.items[i].ptr);
+  l.items.clear();
+}
+
+inline void epoch_domain::retire(participant *p, void *ptr,
+                                 deleter_type deleter)
+{
+  uint64_t e = load_relaxed(&global_epoch);
+  limbo_list &l = p->limbo[e % 3];
+
+  // if this list is from an older epoch, it's from e-3 at the latest,
+  // so it's safe to free
+  if(l.epoch != e) {
+    free_list(l);
+    l.epoch = e;
+  }
+
+  retired r = { ptr, deleter };
+  l.items.push_back(r);
+
+  if(++p->since_advance >= advance_every)
+    collect(p);
+}
+
+inline bool epoch_domain::try_advance()
+{
+  uint64_t e = load_acquire(&global_epoch);
+
+  for(participant *p = load_acquire(&participants); p; p = p->next) {
+    uint64_t pe = load_acquire(&p->epoch);
+    if(pe != 0 && pe != e)
+      return false;
+  }
+
+  return __sync_bool_compare_and_swap(&global_epoch, e, e + 1);
+}
+
+inline void epoch_domain::reclaim(participant *p, uint64_t global)
+{
+  for(uint32_t i = 0; i < 3; ++i)
+    if(p->limbo[i].epoch + 2 <= global)
+      free_list(p->limbo[i]);
+}
+
+inline void epoch_domain::reclaim_orphans(uint64_t global)
+{
+  // whoever holds the lock is already doing this
+  if(pthread_mutex_trylock(&orphan_mutex) != 0)
+    return;
+
+  uint32_t kept = 0;
+  for(uint32_t i = 0; i < orphans.size(); ++i) {
+    if(orphans[i].epoch + 2 <= global)
+      free_list(orphans[i]);
+    else {
+      if(kept != i) {
+        orphans[kept].epoch = orphans[i].epoch;
+        orphans[kept].items.swap(orphans[i].items);
+      }
+      ++kept;
+    }
+  }
+  orphans.resize(kept);
+  store_release(&n_orphans, kept);
+
+  pthread_mutex_unlock(&orphan_mutex);
+}
+
+inline void epoch_domain::collect(participant *p)
+{
+  p->since_advance = 0;
+  try_advance();
+
+  uint64_t global = load_acquire(&global_epoch);
+  reclaim(p, global);
+  if(load_relaxed(&n_orphans) != 0)
+    reclaim_orphans(global);
+}
+
+#endif // _KRB_EPOCH_HPP
@@ -0,0 +1,136 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Thin wrappers around the Linux futex system call, for building
+  blocking waits into lock-free structures.  A futex is just an
+  aligned 32-bit word: futex_wait() puts the calling thread to sleep
+  if (and only if) the word still holds the value it expects, and
+  futex_wake() wakes threads sleeping on the word.  The usual pattern
+  is for a waiter to bump a waiter count, re-check its condition, and
+  then wait on whatever word changes when the condition might have
+  become true; the other side changes the word and then only calls
+  futex_wake() if the waiter count is nonzero, so nobody makes a
+  system call unless somebody is actually asleep.
+
+  Deadlines are absolute CLOCK_MONOTONIC times, so a wait that gets
+  woken spuriously and goes around again doesn't stretch its timeout;
+  futex_deadline() computes one from a timeout in milliseconds.
+
+  That pattern needs a full barrier on both sides, between the store
+  and the load, or each side can miss the other's store and the
+  waiter sleeps through its wake-up.  The waker pays that on every
+  operation, though, and the waiter only when it's about to sleep, so
+  light_fence() and heavy_fence() split the cost unevenly: where the
+  kernel has membarrier(), the light side is just a compiler barrier
+  and the heavy side has the kernel run a barrier on every CPU that's
+  currently running one of our threads.  Elsewhere both are ordinary
+  full barriers.
+
+  The futexes used here are process-private.
+*/
+
+#ifndef _KRB_FUTEX_HPP
+#define _KRB_FUTEX_HPP
+
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <krb/atomic_ops.hpp>
+
+// from linux/membarrier.h, which older systems don't have
+#define KRB_MEMBARRIER_PRIVATE_EXPEDITED (1 << 3)
+#define KRB_MEMBARRIER_REGISTER_PRIVATE_EXPEDITED (1 << 4)
+
+// sleep until woken, as long as *addr == expected.  deadline is an
+// absolute CLOCK_MONOTONIC time, or NULL to wait forever.  returns 0
+// if woken (possibly spuriously); -1 with errno set to EAGAIN if *addr
+// didn't hold expected, ETIMEDOUT if the deadline passed, or EINTR.
+inline int futex_wait(volatile uint32_t *addr, uint32_t expected,
+                      const struct timespec *deadline = NULL)
+{
+  // FUTEX_WAIT takes a relative timeout; the bitset variant takes an
+  // absolute one
+  return syscall(SYS_futex, (uint32_t *)addr,
+                 FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, expected,
+                 deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+// wake up to n threads waiting on addr; returns the number woken
+inline int futex_wake(volatile uint32_t *addr, int n = INT_MAX)
+{
+  return syscall(SYS_futex, (uint32_t *)addr,
+                 FUTEX_WAKE | FUTEX_PRIVATE_FLAG, n, NULL, NULL, 0);
+}
+
+// compute the deadline timeout_ms from now, for futex_wait
+inline void futex_deadline(struct timespec &deadline, uint32_t timeout_ms)
+{
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  uint64_t nsec = (uint64_t)deadline.tv_nsec +
+    (uint64_t)(timeout_ms % 1000) * 1000000;
+  deadline.tv_sec += timeout_ms / 1000 + nsec / 1000000000;
+  deadline.tv_nsec = nsec % 1000000000;
+}
+
+// true if heavy_fence() can stand in for a barrier on the other side
+inline bool asymmetric_fences()
+{
+#ifdef __NR_membarrier
+  static const bool registered =
+    syscall(__NR_membarrier, KRB_MEMBARRIER_REGISTER_PRIVATE_EXPEDITED,
+            0) == 0;
+  return registered;
+#else
+  return false;
+#endif
+}
+
+// the cheap half of a store-then-load handshake, for the side that
+// runs it often
+inline void light_fence()
+{
+  if(asymmetric_fences())
+    compiler_barrier();
+  else
+    full_barrier();
+}
+
+// the expensive half, for the side that's about to sleep anyway
+inline void heavy_fence()
+{
+#ifdef __NR_membarrier
+  if(asymmetric_fences() &&
+     syscall(__NR_membarrier, KRB_MEMBARRIER_PRIVATE_EXPEDITED, 0) == 0)
+    return;
+#endif
+  full_barrier();
+}
+
+#endif // _KRB_FUTEX_HPP
@@ -99,6 +99,9 @@ public:
     pthread_rwlock_unlock(&L);
   }
 
+  // note that this drops the read lock before taking the write lock,
+  // so anything checked under the read lock must be checked again.
+  // see upgradable_rwlock (upgrade_lock.hpp) for an atomic upgrade.
   void upgrade_to_write()
   {
     pthread_rwlock_unlock(&L);
@@ -0,0 +1,265 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A resource pool with lock-free fetch and release.  It has the same
+  interface, watermarks, and sizing policies as resource_pool (see
+  resource_pool.hpp), and can be dropped in wherever many threads
+  borrow and return resources at a high rate.
+
+  Free resources are kept on a Treiber stack.  The stack's head is a
+  single 64-bit word holding the index of the top slot and a tag that
+  is bumped on every update, so a compare-and-swap on the head can't
+  be fooled by the ABA problem.  Resources live in a resource_slab
+  (see resource_slab.hpp), whose chunks of slots are never freed while
+  the pool exists, so a thread that loses a race on the head can
+  always still safely read the slot it was looking at.
+
+  Only growing and shrinking the pool take the pool's mutex.  fetch()
+  takes it when the free stack is empty, and release() try-locks it
+  when the sizing policy wants the pool to shrink (if somebody else
+  holds it, the shrink is simply skipped until the next release).
+
+  Unlike resource_pool:
+
+    * recycle() is called without any lock held, so it may run
+      concurrently for different resources.
+    * a shrink destroys the most recently released resources rather
+      than the ones that have been idle the longest.
+    * free() and used() are only approximate while other threads are
+      fetching and releasing.
+*/
+
+#ifndef _KRB_LOCKFREE_RESOURCE_POOL_HPP
+#define _KRB_LOCKFREE_RESOURCE_POOL_HPP
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <algorithm>
+#include <krb/resource_pool.hpp>
+#include <krb/resource_slab.hpp>
+#include <krb/locker.hpp>
+#include <krb/atomic_ops.hpp>
+
+
+template <class Resource, class Policy = basic_pool_policy>
+class lockfree_resource_pool
+{
+public:
+
+  lockfree_resource_pool(uint32_t low_watermark, uint32_t high_watermark);
+  virtual ~lockfree_resource_pool();
+
+  // get a resource from the pool, or return NULL on failure (i.e.,
+  // we've hit the high watermark)
+  Resource * fetch();
+
+  // release a resource back into the pool, and "recycle" it if
+  // necessary
+  void release(Resource *r);
+
+  uint32_t allocated() const { return slab.live(); }
+  uint32_t used() const { return allocated() - free(); }
+  uint32_t free() const
+  {
+    // n_free can dip below zero for a moment when a pop beats the
+    // push that preceded it to updating the count
+    int32_t n = n_free;
+    return n < 0 ? 0 : std::min((uint32_t)n, allocated());
+  }
+  uint32_t low_watermark() const { return wm_low; }
+  uint32_t high_watermark() const { return wm_high; }
+
+protected:
+
+  // perform any necessary actions on a newly released resource
+  virtual void recycle(Resource *r) {}
+
+  struct slot_links
+  {
+    volatile uint32_t next; // index+1 of the next free slot, or 0
+  };
+
+  typedef resource_slab<Resource, slot_links> slab_type;
+
+  // the free stack: low 32 bits are index+1 of the top slot (0 if
+  // empty), high 32 bits are the ABA tag
+  bool pop(uint32_t &i);
+  void push(uint32_t i);
+
+  // slow paths, called with the mutex held
+  Resource * grow();
+  void shrink();
+
+  uint32_t wm_low, wm_high;
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint64_t head;
+  char pad1[KRB_CACHE_LINE];
+  volatile int32_t n_free;
+  char pad2[KRB_CACHE_LINE];
+
+  slab_type slab;
+  pthread_mutex_t mutex;
+  Policy policy;
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class Resource, class Policy>
+lockfree_resource_pool<Resource, Policy>::lockfree_resource_pool
+  (uint32_t low_watermark, uint32_t high_watermark)
+    : wm_low(low_watermark), wm_high(high_watermark),
+      head(0), n_free(0)
+{
+  pthread_mutex_init(&mutex, NULL);
+}
+
+template <class Resource, class Policy>
+lockfree_resource_pool<Resource, Policy>::~lockfree_resource_pool()
+{
+  // the slab destroys whatever resources are left
+  pthread_mutex_destroy(&mutex);
+}
+
+template <class Resource, class Policy>
+bool lockfree_resource_pool<Resource, Policy>::pop(uint32_t &i)
+{
+  uint64_t old_head, new_head;
+  do {
+    old_head = load_acquire(&head);
+    uint32_t top = (uint32_t)old_head;
+    if(top == 0)
+      return false;
+    i = top - 1;
+    new_head = (((old_head >> 32) + 1) << 32) | slab[i].links.next;
+  } while(!__sync_bool_compare_and_swap(&head, old_head, new_head));
+
+  __sync_fetch_and_sub(&n_free, 1);
+  return true;
+}
+
+template <class Resource, class Policy>
+void lockfree_resource_pool<Resource, Policy>::push(uint32_t i)
+{
+  slot_links &s = slab[i].links;
+  uint64_t old_head, new_head;
+  do {
+    old_head = load_acquire(&head);
+    s.next = (uint32_t)old_head;
+    new_head = (((old_head >> 32) + 1) << 32) | (i + 1);
+  } while(!__sync_bool_compare_and_swap(&head, old_head, new_head));
+
+  __sync_fetch_and_add(&n_free, 1);
+}
+
+template <class Resource, class Policy>
+Resource * lockfree_resource_pool<Resource, Policy>::fetch()
+{
+  uint32_t i;
+  if(pop(i))
+    return slab[i].resource();
+
+  locker L(mutex);
+
+  // somebody may have released or grown while we waited for the lock
+  if(pop(i))
+    return slab[i].resource();
+
+  return grow();
+}
+
+template <class Resource, class Policy>
+Resource * lockfree_resource_pool<Resource, Policy>::grow()
+{
+  uint32_t n_allocated = slab.live();
+  if(n_allocated >= wm_high)
+    return NULL;
+
+  // ask the pool sizing policy how much we should grow
+  uint32_t grow = n_allocated == 0 ? wm_low :
+    std::min(policy.grow(n_allocated), (uint32_t)(wm_high - n_allocated));
+  grow = std::max(grow, (uint32_t)1);
+
+  Resource *r = NULL;
+  for(uint32_t n = 0; n < grow; ++n) {
+    uint32_t i = slab.allocate();
+    Resource *fresh = slab.construct(i);
+    recycle(fresh);
+
+    // keep the first one for ourselves
+    if(r)
+      push(i);
+    else
+      r = fresh;
+  }
+
+  return r;
+}
+
+template <class Resource, class Policy>
+void lockfree_resource_pool<Resource, Policy>::release(Resource *r)
+{
+  recycle(r);
+  push(slab_type::slot_of(r)->index);
+
+  // should we release some resources?  don't wait around if someone
+  // else is already growing or shrinking.
+  uint32_t n_allocated = slab.live();
+  if(n_allocated <= wm_low || policy.shrink(n_allocated, free()) == 0 ||
+     pthread_mutex_trylock(&mutex) != 0)
+  {
+    return;
+  }
+
+  shrink();
+  pthread_mutex_unlock(&mutex);
+}
+
+template <class Resource, class Policy>
+void lockfree_resource_pool<Resource, Policy>::shrink()
+{
+  // nobody else can change n_allocated now, but free() may still be
+  // moving
+  uint32_t n_allocated = slab.live();
+  if(n_allocated <= wm_low)
+    return;
+
+  uint32_t remove = policy.shrink(n_allocated, free());
+  if(n_allocated - remove < wm_low)
+    remove = n_allocated - wm_low;
+
+  uint32_t i;
+  for(; remove > 0 && pop(i); --remove) {
+    slab.destroy(i);
+    slab.deallocate(i);
+  }
+}
+
+#endif // _KRB_LOCKFREE_RESOURCE_POOL_HPP
@@ -0,0 +1,182 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A fixed-size ring of records that any number of threads can append
+  to at once and that keeps only the most recent ones, for things like
+  "the last 1000 requests" kept in memory for debugging or sampling.
+  Writers never block or wait for each other or for readers: a write
+  is one atomic increment, one compare-and-swap, and a copy of the
+  record.  Readers take a snapshot of the most recent records without
+  stopping the writers.
+
+  It's lossy in two ways.  Old records are overwritten as new ones
+  come in, of course.  And if writers lap the ring so fast that two of
+  them land on the same slot at the same time (or a slower writer gets
+  there after a newer record already has), one record is dropped
+  rather than making anybody wait; write() returns false when that
+  happens.
+
+  Every slot carries a sequence number derived from the position of
+  the record it holds: 2 * (pos + 1) once the record is complete, one
+  less than that while a writer is copying it in.  A reader copies a
+  slot's record and then checks the sequence number again, like a
+  seqlock, and skips records that were changed under it.  A snapshot
+  is therefore a consistent set of individual records, in order, but
+  may have gaps where records were being written or got overwritten
+  while it was taken.
+
+  T should be a plain old data type.  The capacity is rounded up to a
+  power of two.
+*/
+
+#ifndef _KRB_LOSSY_RING_HPP
+#define _KRB_LOSSY_RING_HPP
+
+#include <inttypes.h>
+#include <string.h>
+#include <krb/atomic_ops.hpp>
+
+template <class T>
+class lossy_ring
+{
+public:
+  // size is rounded up to a power of two
+  lossy_ring(uint32_t size);
+  ~lossy_ring();
+
+  // append a record; returns false if it was dropped because of a
+  // collision with another writer
+  bool write(const T &rec);
+
+  // copy up to max of the most recent records into out, oldest
+  // first, and return how many were copied.  if pos_out is given, it
+  // gets each record's position (its index in the sequence of all
+  // records ever written).
+  uint32_t snapshot(T *out, uint32_t max, uint64_t *pos_out = NULL) const;
+
+  // number of records ever written (including overwritten ones)
+  uint64_t written() const { return load_acquire(&next); }
+  uint32_t capacity() const { return buf_sz; }
+
+protected:
+
+  lossy_ring(const lossy_ring &);             // no copying
+  lossy_ring & operator=(const lossy_ring &);
+
+  struct slot
+  {
+    volatile uint64_t seq;
+    T data;
+  };
+
+  slot *buf;
+  uint32_t buf_sz, mask;
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint64_t next; // position of the next record to write
+  char pad1[KRB_CACHE_LINE];
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class T>
+lossy_ring<T>::lossy_ring(uint32_t size)
+  : next(0)
+{
+  buf_sz = 1;
+  while(buf_sz < size)
+    buf_sz <<= 1;
+  mask = buf_sz - 1;
+
+  buf = new slot[buf_sz];
+  for(uint32_t i = 0; i < buf_sz; ++i)
+    buf[i].seq = 0;
+}
+
+template <class T>
+lossy_ring<T>::~lossy_ring()
+{
+  delete [] buf;
+}
+
+template <class T>
+bool lossy_ring<T>::write(const T &rec)
+{
+  const uint64_t pos = __sync_fetch_and_add(&next, 1);
+  slot &s = buf[pos & mask];
+  const uint64_t done = 2 * (pos + 1);
+
+  // claim the slot, unless another writer is in it or it already
+  // holds a newer record
+  uint64_t seq = load_acquire(&s.seq);
+  if((seq & 1) || seq >= done ||
+     !__sync_bool_compare_and_swap(&s.seq, seq, done - 1))
+  {
+    return false;
+  }
+
+  memcpy(&s.data, &rec, sizeof(T));
+  store_release(&s.seq, done);
+  return true;
+}
+
+template <class T>
+uint32_t lossy_ring<T>::snapshot
+  (T *out, uint32_t max, uint64_t *pos_out) const
+{
+  const uint64_t end = load_acquire(&next);
+  uint64_t pos = end > buf_sz ? end - buf_sz : 0;
+  if(end - pos > max)
+    pos = end - max;
+
+  uint32_t n = 0;
+  for(; pos < end; ++pos) {
+    const slot &s = buf[pos & mask];
+    const uint64_t want = 2 * (pos + 1);
+
+    if(load_acquire(&s.seq) != want)
+      continue; // not written yet, or already overwritten
+
+    memcpy(&out[n], &s.data, sizeof(T));
+
+    // make sure our copy is done before we look at seq again
+    full_barrier();
+    if(load_relaxed(&s.seq) != want)
+      continue;
+
+    if(pos_out)
+      pos_out[n] = pos;
+    ++n;
+  }
+
+  return n;
+}
+
+#endif // _KRB_LOSSY_RING_HPP
@@ -25,6 +25,10 @@
 
 /*
   A simple templated LRU cache.  This is not thread safe.
+
+  The optional Alloc template argument is used (rebound) for the
+  cache's list and hash nodes; pool_allocator (pool_allocator.hpp)
+  saves a malloc and a free for every insert and eviction.
 */
 
 #ifndef _KRB_LRU_CACHE_HPP
@@ -32,10 +36,12 @@
 
 #include <inttypes.h>
 #include <list>
+#include <memory>
+#include <functional>
 #include <tr1/unordered_map>
 
 
-template <class Key, class Data>
+template <class Key, class Data, class Alloc = std::allocator<Data> >
 class lru_cache_t
 {
 protected:
@@ -49,8 +55,14 @@ protected:
       : key(k), value(v), size(sz) {}
   };
 
-  typedef std::list<lru_item_t> lru_list_t;
-  typedef std::tr1::unordered_map<Key, typename lru_list_t::iterator> key_hash_t;
+  typedef std::list
+    <lru_item_t, typename Alloc::template rebind<lru_item_t>::other>
+      lru_list_t;
+  typedef std::pair<const Key, typename lru_list_t::iterator> key_hash_item_t;
+  typedef std::tr1::unordered_map
+    <Key, typename lru_list_t::iterator, std::tr1::hash<Key>,
+     std::equal_to<Key>,
+     typename Alloc::template rebind<key_hash_item_t>::other> key_hash_t;
 
   void access(typename lru_list_t::iterator li);
 
@@ -107,16 +119,16 @@ protected:
 ///// implementation details
 
 // move li to the MRU spot
-template <class Key, class Data>
-void lru_cache_t<Key, Data>::access(typename lru_list_t::iterator li)
+template <class Key, class Data, class Alloc>
+void lru_cache_t<Key, Data, Alloc>::access(typename lru_list_t::iterator li)
 {
   lru_list.splice(lru_list.begin(), lru_list, li);
 }
 
-template <class Key, class Data>
-Data * lru_cache_t<Key, Data>::lookup(const Key &k)
+template <class Key, class Data, class Alloc>
+Data * lru_cache_t<Key, Data, Alloc>::lookup(const Key &k)
 {
-  typename lru_cache_t<Key, Data>::key_hash_t::iterator ki =
+  typename lru_cache_t<Key, Data, Alloc>::key_hash_t::iterator ki =
     key_hash.find(k);
 
   if(ki != key_hash.end()) { // found!
@@ -130,11 +142,11 @@ Data * lru_cache_t<Key, Data>::lookup(const Key &k)
   }
 }
 
-template <class Key, class Data>
-void lru_cache_t<Key, Data>::insert
+template <class Key, class Data, class Alloc>
+void lru_cache_t<Key, Data, Alloc>::insert
   (const Key &k, const Data &value, uint32_t sz)
 {
-  typename lru_cache_t<Key, Data>::key_hash_t::iterator ki =
+  typename lru_cache_t<Key, Data, Alloc>::key_hash_t::iterator ki =
     key_hash.find(k);
 
   if(ki != key_hash.end()) {
@@ -154,7 +166,7 @@ void lru_cache_t<Key, Data>::insert
 
     // discard LRU items until the cache's size is within our limit
     while(cur_size > max_size) {
-      typename lru_cache_t<Key, Data>::lru_list_t::iterator li_last =
+      typename lru_cache_t<Key, Data, Alloc>::lru_list_t::iterator li_last =
         lru_list.end();
       --li_last;
 
@@ -166,10 +178,10 @@ void lru_cache_t<Key, Data>::insert
   }
 }
 
-template <class Key, class Data>
-bool lru_cache_t<Key, Data>::purge(const Key &k)
+template <class Key, class Data, class Alloc>
+bool lru_cache_t<Key, Data, Alloc>::purge(const Key &k)
 {
-  typename lru_cache_t<Key, Data>::key_hash_t::iterator ki =
+  typename lru_cache_t<Key, Data, Alloc>::key_hash_t::iterator ki =
     key_hash.find(k);
 
   if(ki != key_hash.end()) {
@@ -181,16 +193,16 @@ bool lru_cache_t<Key, Data>::purge(const Key &k)
     return false;
 }
 
-template <class Key, class Data>
-void lru_cache_t<Key, Data>::clear()
+template <class Key, class Data, class Alloc>
+void lru_cache_t<Key, Data, Alloc>::clear()
 {
   key_hash.clear();
   lru_list.clear();
   cur_size = 0;
 }
 
-template <class Key, class Data>
-void lru_cache_t<Key, Data>::resize(uint32_t size_limit)
+template <class Key, class Data, class Alloc>
+void lru_cache_t<Key, Data, Alloc>::resize(uint32_t size_limit)
 {
   max_size = size_limit;
 }
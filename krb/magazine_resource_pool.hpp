@@ -0,0 +1,273 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A resource_pool with a per-thread "magazine" in front of it, as in
+  the slab allocator.  Each thread keeps a small stack of free
+  resources of its own.  fetch() pops from the calling thread's
+  magazine and release() pushes onto it, so in the common case,
+  where a resource is returned by the same thread that borrowed it,
+  neither touches any shared data at all.  When a magazine runs dry
+  it's refilled with half a magazine's worth of resources from the
+  shared pool in one go; when it fills up, half of it is flushed back
+  to the shared pool in one go.
+
+  As far as the shared pool is concerned, resources sitting in
+  magazines are in use: they count toward the high watermark and are
+  never destroyed by a shrink.  That also means that with a small
+  high watermark, one thread can find the shared pool empty while
+  other threads have resources cached.  Keep MagazineSize small
+  relative to the high watermark, and call flush() from threads that
+  are going idle for a while.  A thread's magazine is flushed
+  automatically when the thread exits.  Since cached resources count
+  as in use, maintain() doesn't expire them either; fetch() does still
+  validate them before handing them out.
+
+  recycle() is still called on every release, just as for
+  resource_pool, but outside any lock.  While anybody is blocked in
+  fetch_wait() or fetch_async() on the shared pool, release() skips
+  the magazine and hands the resource straight to the shared pool.
+
+  Each pool uses one pthread key, and there is a limited number of
+  those per process (PTHREAD_KEYS_MAX), so don't create thousands of
+  these.
+*/
+
+#ifndef _KRB_MAGAZINE_RESOURCE_POOL_HPP
+#define _KRB_MAGAZINE_RESOURCE_POOL_HPP
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <krb/resource_pool.hpp>
+#include <krb/locker.hpp>
+#include <krb/exceptions.hpp>
+#include <krb/atomic_ops.hpp>
+
+
+template <class Resource, class Policy = basic_pool_policy,
+          uint32_t MagazineSize = 16>
+class magazine_resource_pool : public resource_pool<Resource, Policy>
+{
+public:
+
+  magazine_resource_pool(uint32_t low_watermark, uint32_t high_watermark);
+  virtual ~magazine_resource_pool();
+
+  // get a resource from the calling thread's magazine, refilling it
+  // from the shared pool if necessary; returns NULL if the magazine
+  // is empty and the shared pool is at its high watermark
+  // (these override resource_pool's, so the magazines are used even
+  // through a resource_pool reference)
+  virtual Resource * fetch();
+
+  // release a resource into the calling thread's magazine, flushing
+  // some of the magazine to the shared pool if it's full
+  virtual void release(Resource *r);
+
+  // return all of the calling thread's cached resources to the
+  // shared pool
+  void flush();
+
+  // number of resources currently cached in all threads' magazines.
+  // this is only approximate: other threads' magazine counts are read
+  // without synchronizing with those threads, so they may be stale
+  // or mid-update.
+  uint32_t cached() const;
+
+protected:
+
+  typedef resource_pool<Resource, Policy> base;
+
+  // how many resources we move to or from the shared pool at once
+  static const uint32_t batch = MagazineSize / 2 ? MagazineSize / 2 : 1;
+
+  struct magazine
+  {
+    char pad0[KRB_CACHE_LINE];
+    magazine_resource_pool *pool;
+    magazine *prev, *next;
+    uint32_t n;
+    Resource *items[MagazineSize];
+    char pad1[KRB_CACHE_LINE];
+  };
+
+  magazine * get_magazine();
+  void destroy_magazine(magazine *M);
+  static void thread_exit(void *arg);
+
+  pthread_key_t key;
+  mutable pthread_mutex_t mag_mutex;
+  magazine *mags; // all magazines, so we can clean up
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+magazine_resource_pool<Resource, Policy, MagazineSize>::magazine_resource_pool
+  (uint32_t low_watermark, uint32_t high_watermark)
+    : base(low_watermark, high_watermark), mags(NULL)
+{
+  int rv = pthread_key_create(&key, &thread_exit);
+  if(rv != 0)
+    throw strerror_exception("Creating magazine pool key", rv);
+  pthread_mutex_init(&mag_mutex, NULL);
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+magazine_resource_pool<Resource, Policy, MagazineSize>::~magazine_resource_pool()
+{
+  // the resources themselves are destroyed along with the shared
+  // pool; we just need to get rid of the magazines
+  pthread_key_delete(key);
+  while(mags) {
+    magazine *M = mags;
+    mags = mags->next;
+    delete M;
+  }
+  pthread_mutex_destroy(&mag_mutex);
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+typename magazine_resource_pool<Resource, Policy, MagazineSize>::magazine *
+magazine_resource_pool<Resource, Policy, MagazineSize>::get_magazine()
+{
+  magazine *M = (magazine *)pthread_getspecific(key);
+  if(M)
+    return M;
+
+  // first time this thread has used the pool
+  M = new magazine;
+  M->pool = this;
+  M->n = 0;
+  M->prev = NULL;
+
+  {
+    locker L(mag_mutex);
+    M->next = mags;
+    if(mags)
+      mags->prev = M;
+    mags = M;
+  }
+
+  pthread_setspecific(key, M);
+  return M;
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+void magazine_resource_pool<Resource, Policy, MagazineSize>::destroy_magazine
+  (magazine *M)
+{
+  this->put_back(M->items, M->n, false);
+
+  locker L(mag_mutex);
+  if(M->prev)
+    M->prev->next = M->next;
+  else
+    mags = M->next;
+  if(M->next)
+    M->next->prev = M->prev;
+  delete M;
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+void magazine_resource_pool<Resource, Policy, MagazineSize>::thread_exit
+  (void *arg)
+{
+  magazine *M = (magazine *)arg;
+  M->pool->destroy_magazine(M);
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+Resource * magazine_resource_pool<Resource, Policy, MagazineSize>::fetch()
+{
+  magazine *M = get_magazine();
+
+  // resources that have been sitting in the magazine get validated
+  // here; fresh ones from the shared pool already have been
+  while(M->n > 0) {
+    Resource *r = M->items[--M->n];
+    if(this->validate(r))
+      return r;
+    this->quarantine(r);
+  }
+
+  M->n = this->fetch_many(M->items, batch);
+  if(M->n == 0)
+    return NULL;
+
+  return M->items[--M->n];
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+void magazine_resource_pool<Resource, Policy, MagazineSize>::release
+  (Resource *r)
+{
+  magazine *M = get_magazine();
+
+  this->recycle(r);
+
+  // if anybody is blocked waiting on the shared pool, don't sit on
+  // the resource
+  if(this->n_waiters) {
+    this->put_back(&r, 1, false);
+    return;
+  }
+
+  if(M->n == MagazineSize) {
+    // full; send the older half back to the shared pool
+    this->put_back(M->items, batch, false);
+    for(uint32_t i = batch; i < MagazineSize; ++i)
+      M->items[i - batch] = M->items[i];
+    M->n -= batch;
+  }
+
+  M->items[M->n++] = r;
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+void magazine_resource_pool<Resource, Policy, MagazineSize>::flush()
+{
+  magazine *M = (magazine *)pthread_getspecific(key);
+  if(M && M->n > 0) {
+    this->put_back(M->items, M->n, false);
+    M->n = 0;
+  }
+}
+
+template <class Resource, class Policy, uint32_t MagazineSize>
+uint32_t magazine_resource_pool<Resource, Policy, MagazineSize>::cached() const
+{
+  locker L(mag_mutex);
+  uint32_t n = 0;
+  for(magazine *M = mags; M; M = M->next)
+    n += load_relaxed(&M->n);
+  return n;
+}
+
+#endif // _KRB_MAGAZINE_RESOURCE_POOL_HPP
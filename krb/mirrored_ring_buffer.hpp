@@ -0,0 +1,108 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A byte ring buffer whose memory is mapped twice, back to back, so
+  that the bytes at offset i and offset i + capacity() are the same
+  physical memory.  Any run of up to capacity() bytes starting
+  anywhere in the first mapping is therefore contiguous in virtual
+  memory, even if it wraps around the end of the ring: reads and
+  writes are always a single memcpy, peek() can return a pointer into
+  the buffer instead of copying, and write_direct_access() always has
+  all of the available space in front of it.  That means you can, for
+  instance, recv() straight into the buffer and parse records straight
+  out of it, without ever copying a record that happens to straddle
+  the wrap point.
+
+  The backing memory is an anonymous shared memory file (memfd_create
+  where the kernel has it, otherwise a file in /dev/shm that's
+  unlinked right away).  The capacity is rounded up to a multiple of
+  the page size.  The constructor throws a strerror_exception if it
+  can't set up the mappings.
+
+  read_from_fd() and write_to_fd() work just like ring_buffer's, but
+  since the free space and the data are always contiguous, each is a
+  plain read() or write().
+
+  Like ring_buffer, this is not thread safe.
+*/
+
+#ifndef _KRB_MIRRORED_RING_BUFFER_HPP
+#define _KRB_MIRRORED_RING_BUFFER_HPP
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/types.h>
+
+class mirrored_ring_buffer
+{
+public:
+  // size is rounded up to a multiple of the page size
+  mirrored_ring_buffer(uint32_t size);
+  ~mirrored_ring_buffer();
+
+  bool read(char *out, uint32_t n);
+  bool read_advance(uint32_t n);
+
+  // returns a pointer to the next n bytes, or NULL if there aren't
+  // that many.  the pointer is good until they're read.
+  const char * peek(uint32_t n) const
+  {
+    return n <= count ? buf + start : NULL;
+  }
+
+  char * write_direct_access() { return buf + end(); }
+  bool write(const char *in, uint32_t n);
+  bool write_advance(uint32_t n);
+
+  // read up to max bytes from fd into the ring / write up to max
+  // bytes from the ring to fd.  these return what read()/write() did,
+  // retrying if interrupted; read_from_fd fails with ENOBUFS if the
+  // ring is full.
+  ssize_t read_from_fd(int fd, uint32_t max);
+  ssize_t write_to_fd(int fd, uint32_t max);
+
+  uint32_t used() const { return count; }
+  uint32_t available() const { return buf_sz - count; }
+  uint32_t available_contiguous() const { return available(); }
+  uint32_t capacity() const { return buf_sz; }
+  bool full() const { return count == buf_sz; }
+
+protected:
+
+  mirrored_ring_buffer(const mirrored_ring_buffer &); // no copying
+  mirrored_ring_buffer & operator=(const mirrored_ring_buffer &);
+
+  uint32_t end() const
+  {
+    uint32_t e = start + count;
+    return e >= buf_sz ? e - buf_sz : e;
+  }
+
+  char *buf; // 2 * buf_sz bytes of address space
+  uint32_t start, count, buf_sz;
+};
+
+#endif // _KRB_MIRRORED_RING_BUFFER_HPP
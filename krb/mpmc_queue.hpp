@@ -0,0 +1,353 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A bounded multi-producer/multi-consumer queue, after Dmitry Vyukov's
+  design.  The queue is a ring of cells, each with a sequence number
+  that says whose turn it is to use the cell:
+
+    seq == pos      free for the producer enqueueing at position pos
+    seq == pos + 1  full, for the consumer dequeueing at position pos
+
+  A producer claims a position by compare-and-swapping the shared
+  enqueue position forward, fills in the cell, then publishes it by
+  storing pos + 1 in the cell's sequence number; a consumer does the
+  mirror image, storing pos + capacity to hand the cell to the
+  producer one lap later.  Producers and consumers contend only on
+  their own position counter (each on its own cache line), and never
+  wait on each other except when the queue is completely full or
+  empty.
+
+  try_enqueue()/try_dequeue() fail right away if the queue is full or
+  empty.  wait_readable()/wait_writable() wait until the queue has at
+  least so many elements (free cells), spinning briefly and then
+  sleeping on a futex on the enqueue (dequeue) position; producers
+  (consumers) only make the wake-up system call when somebody is
+  asleep.  Since a position is claimed a moment before its cell is
+  filled in (or emptied), a try_dequeue() right after wait_readable()
+  can still fail briefly.  enqueue()/dequeue() handle that: they back
+  off by spinning and then yielding the CPU, and only go to sleep if
+  the queue stays full (empty) for a while.  The bulk versions claim
+  a run of consecutive positions with a single compare-and-swap, and
+  return how many elements they moved (possibly zero).
+
+  The capacity is rounded up to a power of two.  T must be default
+  constructible and assignable; elements are copied in and out.
+*/
+
+#ifndef _KRB_MPMC_QUEUE_HPP
+#define _KRB_MPMC_QUEUE_HPP
+
+#include <inttypes.h>
+#include <sched.h>
+#include <krb/atomic_ops.hpp>
+#include <krb/futex.hpp>
+
+template <class T>
+class mpmc_queue
+{
+public:
+  // size is rounded up to a power of two
+  mpmc_queue(uint32_t size);
+  ~mpmc_queue();
+
+  bool try_enqueue(const T &v);
+  bool try_dequeue(T &out);
+
+  // wait until at least min elements are queued (or min cells are
+  // free), or timeout_ms passes (negative: forever, 0: don't wait).
+  // returns false on timeout.
+  bool wait_readable(uint32_t min, int32_t timeout_ms = -1);
+  bool wait_writable(uint32_t min, int32_t timeout_ms = -1);
+
+  // block until there's room or an element
+  void enqueue(const T &v);
+  void dequeue(T &out);
+
+  // enqueue/dequeue up to n elements; returns the number moved
+  uint32_t try_enqueue_bulk(const T *in, uint32_t n);
+  uint32_t try_dequeue_bulk(T *out, uint32_t n);
+
+  // only a snapshot while other threads are using the queue
+  uint32_t size() const
+  {
+    int32_t n = (int32_t)(load_acquire(&enqueue_pos) -
+                          load_acquire(&dequeue_pos));
+    return n < 0 ? 0 : (n > (int32_t)buf_sz ? buf_sz : n);
+  }
+  uint32_t capacity() const { return buf_sz; }
+  bool empty() const { return size() == 0; }
+
+protected:
+
+  mpmc_queue(const mpmc_queue &);             // no copying
+  mpmc_queue & operator=(const mpmc_queue &);
+
+  struct cell
+  {
+    volatile uint32_t seq;
+    T data;
+  };
+
+  // claim up to n positions starting at *pos_p whose cells have the
+  // given sequence offset (0 for producers, 1 for consumers); returns
+  // the number claimed and their first position in first
+  uint32_t claim(volatile uint32_t *pos_p, uint32_t offset, uint32_t n,
+                 uint32_t &first);
+
+  // wait until ready() is true, sleeping on *pos
+  template <class Ready>
+  bool wait(volatile uint32_t *pos, volatile uint32_t *waiters,
+            Ready ready, int32_t timeout_ms);
+
+  struct is_readable
+  {
+    const mpmc_queue *q;
+    uint32_t min;
+    bool operator()() const { return q->size() >= min; }
+  };
+
+  struct is_writable
+  {
+    const mpmc_queue *q;
+    uint32_t min;
+    bool operator()() const { return q->capacity() - q->size() >= min; }
+  };
+
+  // spin a while, then start yielding the CPU
+  static void backoff(uint32_t &spins)
+  {
+    if(++spins < 64)
+      cpu_relax();
+    else
+      sched_yield();
+  }
+
+  cell *buf;
+  uint32_t buf_sz, mask;
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint32_t enqueue_pos;
+  volatile uint32_t read_waiters; // consumers asleep on enqueue_pos
+  char pad1[KRB_CACHE_LINE];
+  volatile uint32_t dequeue_pos;
+  volatile uint32_t write_waiters; // producers asleep on dequeue_pos
+  char pad2[KRB_CACHE_LINE];
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class T>
+mpmc_queue<T>::mpmc_queue(uint32_t size)
+  : enqueue_pos(0), read_waiters(0), dequeue_pos(0), write_waiters(0)
+{
+  buf_sz = 2;
+  while(buf_sz < size)
+    buf_sz <<= 1;
+  mask = buf_sz - 1;
+
+  buf = new cell[buf_sz];
+  for(uint32_t i = 0; i < buf_sz; ++i)
+    buf[i].seq = i;
+}
+
+template <class T>
+mpmc_queue<T>::~mpmc_queue()
+{
+  delete [] buf;
+}
+
+template <class T>
+uint32_t mpmc_queue<T>::claim
+  (volatile uint32_t *pos_p, uint32_t offset, uint32_t n, uint32_t &first)
+{
+  uint32_t pos = load_relaxed(pos_p);
+
+  while(1) {
+
+    // count how many cells in a row are ready for us
+    uint32_t k = 0;
+    bool stale = false;
+    for(; k < n; ++k) {
+      uint32_t seq = load_acquire(&buf[(pos + k) & mask].seq);
+      int32_t diff = (int32_t)(seq - (pos + k + offset));
+      if(diff != 0) {
+        // if the very first cell is past our position, somebody else
+        // already took it; otherwise the queue is full (or empty)
+        // from here on
+        stale = (diff > 0 && k == 0);
+        break;
+      }
+    }
+
+    if(stale) {
+      pos = load_relaxed(pos_p);
+      continue;
+    }
+    if(k == 0)
+      return 0;
+
+    uint32_t seen = __sync_val_compare_and_swap(pos_p, pos, pos + k);
+    if(seen == pos) {
+      first = pos;
+      return k;
+    }
+    pos = seen;
+  }
+}
+
+template <class T>
+bool mpmc_queue<T>::try_enqueue(const T &v)
+{
+  return try_enqueue_bulk(&v, 1) == 1;
+}
+
+template <class T>
+bool mpmc_queue<T>::try_dequeue(T &out)
+{
+  return try_dequeue_bulk(&out, 1) == 1;
+}
+
+template <class T>
+uint32_t mpmc_queue<T>::try_enqueue_bulk(const T *in, uint32_t n)
+{
+  uint32_t pos;
+  uint32_t k = claim(&enqueue_pos, 0, n, pos);
+
+  for(uint32_t i = 0; i < k; ++i) {
+    cell &c = buf[(pos + i) & mask];
+    c.data = in[i];
+    store_release(&c.seq, pos + i + 1);
+  }
+
+  // claiming the positions was a full barrier, so a consumer that
+  // went to sleep on the old enqueue_pos is already counted
+  if(k > 0 && load_relaxed(&read_waiters))
+    futex_wake(&enqueue_pos);
+
+  return k;
+}
+
+template <class T>
+uint32_t mpmc_queue<T>::try_dequeue_bulk(T *out, uint32_t n)
+{
+  uint32_t pos;
+  uint32_t k = claim(&dequeue_pos, 1, n, pos);
+
+  for(uint32_t i = 0; i < k; ++i) {
+    cell &c = buf[(pos + i) & mask];
+    out[i] = c.data;
+    store_release(&c.seq, pos + i + buf_sz);
+  }
+
+  if(k > 0 && load_relaxed(&write_waiters))
+    futex_wake(&dequeue_pos);
+
+  return k;
+}
+
+template <class T>
+template <class Ready>
+bool mpmc_queue<T>::wait
+  (volatile uint32_t *pos, volatile uint32_t *waiters, Ready ready,
+   int32_t timeout_ms)
+{
+  struct timespec deadline;
+  if(timeout_ms > 0)
+    futex_deadline(deadline, timeout_ms);
+
+  for(uint32_t spins = 0; !ready(); ++spins) {
+    if(timeout_ms == 0)
+      return false;
+    if(spins < 100) {
+      cpu_relax();
+      continue;
+    }
+
+    // announce ourselves, then check again before going to sleep:
+    // anybody who moves *pos after this will see us and wake us up
+    __sync_fetch_and_add(waiters, 1);
+    uint32_t seen = load_acquire(pos);
+    int rv = 0;
+    if(!ready())
+      rv = futex_wait(pos, seen, timeout_ms > 0 ? &deadline : NULL);
+    __sync_fetch_and_sub(waiters, 1);
+
+    if(rv < 0 && errno == ETIMEDOUT)
+      return ready();
+  }
+
+  return true;
+}
+
+template <class T>
+bool mpmc_queue<T>::wait_readable(uint32_t min, int32_t timeout_ms)
+{
+  if(min > buf_sz)
+    return false;
+  is_readable r = { this, min };
+  return wait(&enqueue_pos, &read_waiters, r, timeout_ms);
+}
+
+template <class T>
+bool mpmc_queue<T>::wait_writable(uint32_t min, int32_t timeout_ms)
+{
+  if(min > buf_sz)
+    return false;
+  is_writable w = { this, min };
+  return wait(&dequeue_pos, &write_waiters, w, timeout_ms);
+}
+
+template <class T>
+void mpmc_queue<T>::enqueue(const T &v)
+{
+  // back off for a while before going to sleep, since a consumer
+  // will probably make room soon
+  uint32_t spins = 0;
+  while(!try_enqueue(v)) {
+    if(spins >= 256 && size() == buf_sz)
+      wait_writable(1);
+    else
+      backoff(spins);
+  }
+}
+
+template <class T>
+void mpmc_queue<T>::dequeue(T &out)
+{
+  uint32_t spins = 0;
+  while(!try_dequeue(out)) {
+    if(spins >= 256 && size() == 0)
+      wait_readable(1);
+    else
+      backoff(spins);
+  }
+}
+
+#endif // _KRB_MPMC_QUEUE_HPP
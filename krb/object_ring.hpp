@@ -0,0 +1,298 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A ring buffer of arbitrary objects.  ring_buffer moves elements
+  around with memcpy, so it's only good for plain old data (and really
+  only for bytes); object_ring constructs elements in place when
+  they're pushed and destroys them when they're popped, so it works
+  for strings, structs with pointers in them, smart pointers, and so
+  on.  With C++11 (including g++'s -std=c++0x), elements are moved
+  rather than copied wherever possible, move-only types work, and
+  emplace() constructs an element in place from any constructor
+  arguments.
+
+  Positions are free-running 32-bit counters masked into a
+  power-of-two array (the capacity is rounded up), so there's no
+  pointer arithmetic or branching on wraparound.
+
+  For moving many elements at once without going through push/pop one
+  at a time, there are span operations in the style of ring_buffer's
+  write_direct_access/write_advance:
+
+    emplace_span(n) returns a pointer to raw storage for up to n new
+      elements (setting n to how many fit contiguously); construct
+      them there with placement new, then call emplace_commit(k) with
+      the number actually constructed.
+
+    pop_span(n) returns a pointer to up to n contiguous elements at
+      the front (setting n to how many); use them, then call
+      pop_commit(k) to destroy the first k of them and advance.
+
+  push_bulk() and pop_bulk() do the whole copy (or move) for you.
+
+  This is not thread safe.
+*/
+
+#ifndef _KRB_OBJECT_RING_HPP
+#define _KRB_OBJECT_RING_HPP
+
+#include <inttypes.h>
+#include <new>
+#include <tr1/type_traits>
+
+// g++ 4.4's -std=c++0x has everything we use (rvalue references,
+// variadic templates, std::move and std::forward) but leaves
+// __cplusplus at 1
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+#define KRB_OBJECT_RING_MOVE 1
+#include <utility>
+#endif
+
+template <class T>
+class object_ring
+{
+public:
+  // size is rounded up to a power of two
+  object_ring(uint32_t size);
+  ~object_ring();
+
+  bool push(const T &v);
+#ifdef KRB_OBJECT_RING_MOVE
+  bool push(T &&v);
+  template <class... Args>
+  bool emplace(Args &&... args);
+#endif
+
+  // move (or copy) the front element into out and destroy it
+  bool pop(T &out);
+  // just destroy the front element
+  bool pop_front();
+
+  T & front() { return *at(head); }
+  const T & front() const { return *at(head); }
+  T & back() { return *at(tail - 1); }
+  const T & back() const { return *at(tail - 1); }
+
+  // i-th element from the front
+  T & operator[](uint32_t i) { return *at(head + i); }
+  const T & operator[](uint32_t i) const { return *at(head + i); }
+
+  // span access (see above)
+  T * emplace_span(uint32_t &n);
+  void emplace_commit(uint32_t n) { tail += n; }
+  T * pop_span(uint32_t &n);
+  void pop_commit(uint32_t n);
+
+  // push/pop up to n elements; return the number moved
+  uint32_t push_bulk(const T *in, uint32_t n);
+  uint32_t pop_bulk(T *out, uint32_t n);
+
+  void clear() { pop_commit(used()); }
+
+  uint32_t used() const { return tail - head; }
+  uint32_t available() const { return buf_sz - used(); }
+  uint32_t capacity() const { return buf_sz; }
+  bool empty() const { return head == tail; }
+  bool full() const { return used() == buf_sz; }
+
+protected:
+
+  object_ring(const object_ring &);             // no copying
+  object_ring & operator=(const object_ring &);
+
+  typedef typename std::tr1::aligned_storage
+    <sizeof(T), std::tr1::alignment_of<T>::value>::type storage;
+
+  T * at(uint32_t pos)
+  {
+    return reinterpret_cast<T *>(&buf[pos & mask]);
+  }
+
+  const T * at(uint32_t pos) const
+  {
+    return reinterpret_cast<const T *>(&buf[pos & mask]);
+  }
+
+  storage *buf;
+  uint32_t buf_sz, mask;
+  uint32_t head, tail;
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class T>
+object_ring<T>::object_ring(uint32_t size)
+  : head(0), tail(0)
+{
+  buf_sz = 1;
+  while(buf_sz < size)
+    buf_sz <<= 1;
+  mask = buf_sz - 1;
+  buf = new storage[buf_sz];
+}
+
+template <class T>
+object_ring<T>::~object_ring()
+{
+  clear();
+  delete [] buf;
+}
+
+template <class T>
+bool object_ring<T>::push(const T &v)
+{
+  if(full())
+    return false;
+  new (at(tail)) T(v);
+  ++tail;
+  return true;
+}
+
+#ifdef KRB_OBJECT_RING_MOVE
+template <class T>
+bool object_ring<T>::push(T &&v)
+{
+  if(full())
+    return false;
+  new (at(tail)) T(std::move(v));
+  ++tail;
+  return true;
+}
+
+template <class T>
+template <class... Args>
+bool object_ring<T>::emplace(Args &&... args)
+{
+  if(full())
+    return false;
+  new (at(tail)) T(std::forward<Args>(args)...);
+  ++tail;
+  return true;
+}
+#endif
+
+template <class T>
+bool object_ring<T>::pop(T &out)
+{
+  if(empty())
+    return false;
+#ifdef KRB_OBJECT_RING_MOVE
+  out = std::move(*at(head));
+#else
+  out = *at(head);
+#endif
+  return pop_front();
+}
+
+template <class T>
+bool object_ring<T>::pop_front()
+{
+  if(empty())
+    return false;
+  at(head)->~T();
+  ++head;
+  return true;
+}
+
+template <class T>
+T * object_ring<T>::emplace_span(uint32_t &n)
+{
+  const uint32_t i = tail & mask;
+  const uint32_t end_chunk_size = buf_sz - i;
+  if(n > available())
+    n = available();
+  if(n > end_chunk_size)
+    n = end_chunk_size;
+  return at(tail);
+}
+
+template <class T>
+T * object_ring<T>::pop_span(uint32_t &n)
+{
+  const uint32_t i = head & mask;
+  const uint32_t end_chunk_size = buf_sz - i;
+  if(n > used())
+    n = used();
+  if(n > end_chunk_size)
+    n = end_chunk_size;
+  return at(head);
+}
+
+template <class T>
+void object_ring<T>::pop_commit(uint32_t n)
+{
+  for(uint32_t i = 0; i < n; ++i)
+    at(head + i)->~T();
+  head += n;
+}
+
+template <class T>
+uint32_t object_ring<T>::push_bulk(const T *in, uint32_t n)
+{
+  uint32_t done = 0;
+
+  // at most two spans: up to the end of the array, then from the
+  // beginning
+  for(uint32_t pass = 0; pass < 2 && done < n; ++pass) {
+    uint32_t k = n - done;
+    T *p = emplace_span(k);
+    for(uint32_t i = 0; i < k; ++i) {
+      new (p + i) T(in[done + i]);
+      ++tail; // one at a time, in case a constructor throws
+    }
+    done += k;
+  }
+
+  return done;
+}
+
+template <class T>
+uint32_t object_ring<T>::pop_bulk(T *out, uint32_t n)
+{
+  uint32_t done = 0;
+
+  for(uint32_t pass = 0; pass < 2 && done < n; ++pass) {
+    uint32_t k = n - done;
+    T *p = pop_span(k);
+    for(uint32_t i = 0; i < k; ++i) {
+#ifdef KRB_OBJECT_RING_MOVE
+      out[done + i] = std::move(p[i]);
+#else
+      out[done + i] = p[i];
+#endif
+    }
+    pop_commit(k);
+    done += k;
+  }
+
+  return done;
+}
+
+#endif // _KRB_OBJECT_RING_HPP
@@ -0,0 +1,410 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Parallel loops on top of thread_pool.
+
+    parallel_for(pool, begin, end, grain, body)
+
+  runs body(b, e) over disjoint subranges [b, e) that together cover
+  [begin, end).  Each subrange is at most grain long.
+
+    parallel_reduce(pool, begin, end, grain, identity, body, combine)
+
+  does the same, but body is called as acc = body(b, e, acc) and the
+  per-thread partial results are merged with combine(x, y), starting
+  from identity.  combine must be associative and commutative, since
+  partial results are merged in whatever order threads finish.
+
+  The range is split evenly among the calling thread and as many of
+  the pool's worker threads as are idle.  Each participant eats its
+  own subrange grain by grain from the front; when it runs dry, it
+  steals the back half of the largest remaining subrange.  Subranges
+  belonging to helper jobs that haven't started yet (because, say, a
+  new worker thread is still spinning up) just get stolen, so nobody
+  ever waits on a thread that isn't doing anything useful.
+
+  The calling thread works on the loop too, and the call returns only
+  once the whole range is done.  body must be safe to call from
+  several threads at once.
+
+  These must be called from the thread that owns the thread_pool
+  (i.e., the one running its event loop), since they schedule jobs on
+  it.  They also call process_completed() on the pool to get back
+  worker threads from finished jobs, so callbacks for other finished
+  jobs may be called from inside parallel_for.
+*/
+
+#ifndef _KRB_PARALLEL_HPP
+#define _KRB_PARALLEL_HPP
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <algorithm>
+#include <krb/thread_pool.hpp>
+#include <krb/locker.hpp>
+#include <krb/atomic_ops.hpp>
+
+
+template <class Policy, class Body>
+void parallel_for
+  (thread_pool<Policy> &pool, uint64_t begin, uint64_t end,
+   uint64_t grain, Body &body);
+
+template <class Policy, class T, class Body, class Combine>
+T parallel_reduce
+  (thread_pool<Policy> &pool, uint64_t begin, uint64_t end,
+   uint64_t grain, const T &identity, Body &body, Combine &combine);
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+// one participant's share of the range, padded out to a cache line
+// so participants don't fight over each other's slots
+struct parallel_slot
+{
+  volatile uint64_t begin, end;
+  volatile int lock;
+  char pad[KRB_CACHE_LINE - 2*sizeof(uint64_t) - sizeof(int)];
+
+  void acquire()
+  {
+    while(__sync_lock_test_and_set(&lock, 1))
+      while(lock)
+        cpu_relax();
+  }
+
+  void release() { __sync_lock_release(&lock); }
+
+  uint64_t remaining() const { return end - begin; }
+};
+
+// state shared between the calling thread and its helper jobs.  this
+// is reference counted because helper jobs may not start running
+// until well after the loop has finished.
+class parallel_state
+{
+public:
+
+  parallel_state
+    (uint32_t participants, uint64_t begin, uint64_t end, uint64_t grain)
+      : refs(participants), active(0), closed(false),
+        nslots(participants), G(grain)
+  {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    // split the range evenly, in whole grains
+    slots = new parallel_slot[nslots];
+    uint64_t chunks = (end - begin + grain - 1) / grain;
+    for(uint32_t i = 0; i < nslots; ++i) {
+      slots[i].lock = 0;
+      slots[i].begin = std::min(begin + grain * (chunks * i / nslots), end);
+      slots[i].end =
+        std::min(begin + grain * (chunks * (i+1) / nslots), end);
+    }
+  }
+
+  ~parallel_state()
+  {
+    delete [] slots;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  // called by a helper job before it touches the loop.  returns false
+  // if the loop is already finished, in which case the helper must not
+  // touch the loop's body at all.
+  bool enter()
+  {
+    __sync_fetch_and_add(&active, 1);
+    if(!closed)
+      return true;
+    leave();
+    return false;
+  }
+
+  void leave()
+  {
+    // we still hold a reference, so the mutex is still around even if
+    // close() returns as soon as we hit zero
+    if(__sync_sub_and_fetch(&active, 1) == 0) {
+      locker L(mutex);
+      pthread_cond_signal(&cond);
+    }
+  }
+
+  // called by the calling thread once the range is exhausted (or it
+  // bails out); waits for helpers that are still working on their
+  // last chunks.  after this returns, no helper will touch the loop.
+  void close()
+  {
+    closed = true;
+    full_barrier();
+    locker L(mutex);
+    while(active > 0)
+      pthread_cond_wait(&cond, &mutex);
+  }
+
+  // throw away whatever work hasn't been started yet
+  void abandon()
+  {
+    for(uint32_t i = 0; i < nslots; ++i) {
+      slots[i].acquire();
+      slots[i].begin = slots[i].end;
+      slots[i].release();
+    }
+  }
+
+  void unref()
+  {
+    if(__sync_sub_and_fetch(&refs, 1) == 0)
+      delete this;
+  }
+
+  // get the next subrange for participant <me> to work on.  returns
+  // false when there's nothing left anywhere.
+  bool take(uint32_t me, uint64_t &b, uint64_t &e)
+  {
+    parallel_slot &mine = slots[me];
+
+    while(1) {
+      mine.acquire();
+      if(mine.begin < mine.end) {
+        b = mine.begin;
+        e = (mine.remaining() > G) ? b + G : mine.end;
+        mine.begin = e;
+        mine.release();
+        return true;
+      }
+      mine.release();
+
+      // our own slot is dry; find the participant with the most work
+      // left and steal from it
+      uint32_t victim = nslots;
+      uint64_t most = 0;
+      for(uint32_t i = 0; i < nslots; ++i) {
+        uint64_t r = slots[i].remaining();
+        if(i != me && slots[i].begin < slots[i].end && r > most) {
+          most = r;
+          victim = i;
+        }
+      }
+
+      if(victim == nslots)
+        return false;
+
+      parallel_slot &V = slots[victim];
+      V.acquire();
+      if(V.begin >= V.end) {
+        // somebody beat us to it; look again
+        V.release();
+        continue;
+      }
+
+      if(V.remaining() <= G) {
+        // not worth splitting, just take the whole thing
+        b = V.begin;
+        e = V.end;
+        V.begin = V.end;
+        V.release();
+        return true;
+      }
+
+      // take the back half, rounded to a whole grain, and put it in
+      // our own slot
+      uint64_t half = (V.remaining() / 2 + G - 1) / G * G;
+      uint64_t mid = V.end - half;
+      uint64_t stolen_end = V.end;
+      V.end = mid;
+      V.release();
+
+      mine.acquire();
+      mine.begin = mid;
+      mine.end = stolen_end;
+      mine.release();
+    }
+  }
+
+  template <class Task>
+  void participate(uint32_t me, Task &task)
+  {
+    uint64_t b, e;
+    while(take(me, b, e))
+      task.chunk(b, e);
+    task.finish();
+  }
+
+protected:
+
+  volatile uint32_t refs, active;
+  volatile bool closed;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  uint32_t nslots;
+  uint64_t G;
+  parallel_slot *slots;
+};
+
+// helper job run on one of the pool's worker threads.  the job
+// deletes itself when the pool calls its callback.
+template <class Task>
+struct parallel_job : public thread_pool_job
+{
+  parallel_job(parallel_state *state, uint32_t slot, const Task &t)
+    : S(state), me(slot), task(t) {}
+
+  void run()
+  {
+    if(S->enter()) {
+      S->participate(me, task);
+      S->leave();
+    }
+    S->unref();
+  }
+
+  void callback() { delete this; }
+
+  parallel_state *S;
+  uint32_t me;
+  Task task;
+};
+
+template <class Body>
+struct parallel_for_task
+{
+  parallel_for_task(Body &b) : body(&b) {}
+  void chunk(uint64_t b, uint64_t e) { (*body)(b, e); }
+  void finish() {}
+  Body *body;
+};
+
+template <class T, class Body, class Combine>
+struct parallel_reduce_task
+{
+  parallel_reduce_task
+    (const T &identity, Body &b, Combine &c, T &r, pthread_mutex_t &m)
+      : acc(identity), body(&b), combine(&c), result(&r), mutex(&m) {}
+
+  void chunk(uint64_t b, uint64_t e) { acc = (*body)(b, e, acc); }
+
+  // merge our partial result into the final one
+  void finish()
+  {
+    locker L(*mutex);
+    *result = (*combine)(*result, acc);
+  }
+
+  T acc;
+  Body *body;
+  Combine *combine;
+  T *result;
+  pthread_mutex_t *mutex;
+};
+
+template <class Policy, class Task>
+void parallel_run
+  (thread_pool<Policy> &pool, uint64_t begin, uint64_t end,
+   uint64_t grain, const Task &proto)
+{
+  if(begin >= end)
+    return;
+  if(grain == 0)
+    grain = 1;
+
+  // get back any worker threads that finished jobs since the event
+  // loop last ran, then figure out how much help we can get
+  pool.process_completed();
+
+  uint64_t chunks = (end - begin + grain - 1) / grain;
+  uint32_t helpers = (uint32_t)std::min<uint64_t>
+    (pool.idle_threads(), chunks - 1);
+
+  Task task(proto);
+
+  if(helpers == 0) {
+    // nothing to split; just do it ourselves
+    for(uint64_t b = begin; b < end; b += grain)
+      task.chunk(b, std::min(b + grain, end));
+    task.finish();
+    return;
+  }
+
+  parallel_state *S = new parallel_state(helpers + 1, begin, end, grain);
+
+  // if a helper fails to start, its share of the range just gets
+  // stolen by the rest of us
+  for(uint32_t i = 1; i <= helpers; ++i)
+    pool.schedule(new parallel_job<Task>(S, i, proto));
+
+  try {
+    S->participate(0, task);
+  } catch(...) {
+    S->abandon();
+    S->close();
+    S->unref();
+    throw;
+  }
+
+  S->close();
+  S->unref();
+}
+
+template <class Policy, class Body>
+void parallel_for
+  (thread_pool<Policy> &pool, uint64_t begin, uint64_t end,
+   uint64_t grain, Body &body)
+{
+  parallel_run(pool, begin, end, grain, parallel_for_task<Body>(body));
+}
+
+template <class Policy, class T, class Body, class Combine>
+T parallel_reduce
+  (thread_pool<Policy> &pool, uint64_t begin, uint64_t end,
+   uint64_t grain, const T &identity, Body &body, Combine &combine)
+{
+  T result = identity;
+  pthread_mutex_t mutex;
+  pthread_mutex_init(&mutex, NULL);
+
+  try {
+    parallel_run
+      (pool, begin, end, grain,
+       parallel_reduce_task<T, Body, Combine>
+         (identity, body, combine, result, mutex));
+  } catch(...) {
+    pthread_mutex_destroy(&mutex);
+    throw;
+  }
+
+  pthread_mutex_destroy(&mutex);
+  return result;
+}
+
+#endif // _KRB_PARALLEL_HPP
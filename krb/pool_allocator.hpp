@@ -0,0 +1,187 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  An STL allocator that hands out fixed-size blocks from a
+  magazine_resource_pool (see magazine_resource_pool.hpp) instead of
+  calling malloc for every node.  It's meant for node-based containers
+  (std::list, std::map, std::multimap, and so on), which only ever
+  allocate one node at a time; requests for more than one object at
+  once (e.g., a vector's array, or a hash table's bucket array) just
+  go to ::operator new.
+
+    std::list<int, pool_allocator<int> > l;
+    lru_cache_t<uint32_t, std::string,
+                pool_allocator<std::string> > cache(1000);
+
+  Blocks are sized in multiples of 16 bytes, and all allocators whose
+  node sizes round to the same block size share one pool, which is
+  created on first use and never destroyed (so it can't disappear
+  under a static container that's destroyed at exit).  The pool never
+  shrinks and has no upper limit: memory freed by a container is kept
+  around for the next node of the same size, and is never returned to
+  the system, so the process's footprint for each block size stays at
+  the most that was ever in use at once.  Each thread caches a few
+  free blocks of its own, so allocating and freeing nodes usually
+  doesn't touch any shared state.
+
+  apache_log_playback's buffer, lru_cache_t, and wss_estimator take
+  an allocator template argument (std::allocator by default), so they
+  only use these pools if you ask them to.
+
+  All pool_allocators are interchangeable, so memory allocated through
+  one can be freed through any other, in any thread.
+*/
+
+#ifndef _KRB_POOL_ALLOCATOR_HPP
+#define _KRB_POOL_ALLOCATOR_HPP
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <new>
+#include <tr1/type_traits>
+#include <krb/magazine_resource_pool.hpp>
+
+
+// one fixed-size chunk of memory.  it has a trivial constructor, so
+// the pool doesn't spend any time initializing blocks.
+template <uint32_t Size>
+struct pool_block
+{
+  typename std::tr1::aligned_storage<Size, 16>::type storage;
+};
+
+// the shared pool of blocks of a given size
+template <uint32_t Size>
+struct pool_block_arena
+{
+  typedef magazine_resource_pool<pool_block<Size>, never_shrink_policy, 32>
+    pool_type;
+
+  static pool_type & pool()
+  {
+    // deliberately leaked; see above
+    static pool_type *p = new pool_type(64, 0xffffffff);
+    return *p;
+  }
+};
+
+
+template <class T>
+class pool_allocator
+{
+public:
+
+  typedef T value_type;
+  typedef T * pointer;
+  typedef const T * const_pointer;
+  typedef T & reference;
+  typedef const T & const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <class U>
+  struct rebind { typedef pool_allocator<U> other; };
+
+  pool_allocator() throw() {}
+  pool_allocator(const pool_allocator &) throw() {}
+  template <class U>
+  pool_allocator(const pool_allocator<U> &) throw() {}
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  pointer allocate(size_type n, const void *hint = 0);
+  void deallocate(pointer p, size_type n);
+
+  size_type max_size() const throw() { return size_t(-1) / sizeof(T); }
+
+  void construct(pointer p, const T &v) { new ((void *)p) T(v); }
+  void destroy(pointer p) { p->~T(); }
+
+protected:
+
+  static const uint32_t block_size = (sizeof(T) + 15) & ~15;
+  static const bool pooled =
+    std::tr1::alignment_of<T>::value <= 16;
+
+  typedef pool_block_arena<block_size> arena;
+};
+
+template <>
+class pool_allocator<void>
+{
+public:
+  typedef void value_type;
+  typedef void * pointer;
+  typedef const void * const_pointer;
+
+  template <class U>
+  struct rebind { typedef pool_allocator<U> other; };
+};
+
+template <class T, class U>
+inline bool operator==(const pool_allocator<T> &, const pool_allocator<U> &)
+{
+  return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const pool_allocator<T> &, const pool_allocator<U> &)
+{
+  return false;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class T>
+typename pool_allocator<T>::pointer pool_allocator<T>::allocate
+  (size_type n, const void *)
+{
+  if(n != 1 || !pooled)
+    return static_cast<pointer>(::operator new(n * sizeof(T)));
+
+  pool_block<block_size> *b = arena::pool().fetch();
+  if(!b)
+    throw std::bad_alloc();
+  return reinterpret_cast<pointer>(b);
+}
+
+template <class T>
+void pool_allocator<T>::deallocate(pointer p, size_type n)
+{
+  if(n != 1 || !pooled) {
+    ::operator delete(p);
+    return;
+  }
+
+  arena::pool().release(reinterpret_cast<pool_block<block_size> *>(p));
+}
+
+#endif // _KRB_POOL_ALLOCATOR_HPP
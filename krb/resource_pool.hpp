@@ -43,17 +43,58 @@
     * fixed_growth_policy<N>
     * fixed_size_policy
 
-  The pool _does not_ keep track of resources that have been reserved
-  for use --- only ones available for use.  When a resource is
-  returned to the pool, it _assumes_ the resource was taken from the
-  pool.  This is a potential pitfall, but improves the pool's
-  efficiency quite a bit.
+  The pool does not check that a resource being returned was actually
+  taken from the pool --- it _assumes_ so.  This is a potential
+  pitfall, but improves the pool's efficiency quite a bit.
+
+  Resources live in slots in a resource_slab (see resource_slab.hpp),
+  so growing the pool allocates a chunk of slots at a time instead of
+  one heap node per resource.  Free resources are kept as slot indices
+  in a ring ordered by release time: fetch takes the most recently
+  released one off the back (it's the most likely to still be in
+  cache), and shrinking and idle expiry take the oldest off the front,
+  so all of these are O(1) and touch no slot but the one they return.
+  Resources removed by a shrink are destroyed after the pool's mutex
+  has been released, so lock hold times don't depend on how expensive
+  the resources are to tear down.  Shrinking destroys resources but
+  not the slab memory they lived in: slots are reused when the pool
+  grows again, and the slab's chunks are only freed along with the
+  pool, so the pool's footprint stays at its high-water mark of slots.
+  With never_shrink_policy, the pool makes a reasonable fixed-size
+  object allocator.
+
+  When the pool is at its high watermark, fetch() just returns NULL.
+  fetch_wait() instead waits (up to a timeout) for a resource to be
+  released, and fetch_async() arranges for a callback to be called
+  with a resource as soon as one is released.  Waiters of both kinds
+  are served in FIFO order: a released resource goes straight to the
+  longest waiter instead of back into the pool, and fetch() and
+  fetch_many() don't take anything while anybody is waiting.
 
   The pool defines a virtual protected "recycle" member function that
   by default does nothing.  Derived pool classes can implement recycle
   to perform any necessary re-initialization of resources that have
   just been returned to the pool, or just been added to the pool after
   a resize.
+
+  Derived classes can also implement the virtual protected "validate"
+  member function, which is called (without the pool's mutex held) on
+  every resource about to be handed out by fetch(), fetch_many(),
+  fetch_wait(), and fetch_async() when a resource is available right
+  away.  A resource that fails validation (say, a connection the
+  server has closed) is quarantined: taken out of circulation and
+  validated once more by the next maintain() call, which puts it back
+  in the pool if it passes and destroys it if it doesn't.  The fetch
+  then tries again with another resource.
+
+  Shrinking normally only happens on release, so an idle pool never
+  gives anything back.  If you set an idle timeout, maintain() also
+  destroys free resources that haven't been used for that long (down
+  to the low watermark); idle times are measured on CLOCK_MONOTONIC,
+  so setting the system clock doesn't expire everything at once.  If
+  maintain() destroys anything while there are waiters, it grows the
+  pool again to serve them.  Call maintain() periodically, e.g. from a
+  libevent timer or a housekeeping thread.
 */
 
 #ifndef _KRB_RESOURCE_POOL_HPP
@@ -61,9 +102,14 @@
 
 #include <inttypes.h>
 #include <pthread.h>
-#include <list>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
 #include <algorithm>
+#include <vector>
 #include <krb/locker.hpp>
+#include <krb/atomic_ops.hpp>
+#include <krb/resource_slab.hpp>
 
 
 // a simple pool sizing policy.  grow() is called with the current
@@ -121,6 +167,19 @@ struct fixed_size_policy
 
 
 
+// callback for fetch_async().  called with the resource, either from
+// inside fetch_async() if one is available right away, or later from
+// whichever thread releases one.  if you're running an event loop,
+// you probably want to hand the resource off to the loop's thread
+// from here.
+template <class Resource>
+struct resource_pool_callback
+{
+  virtual ~resource_pool_callback() {}
+  virtual void operator()(Resource *r) = 0;
+};
+
+
 // the generic resource pool!
 template <class Resource, class Policy = basic_pool_policy>
 class resource_pool
@@ -131,28 +190,164 @@ public:
   virtual ~resource_pool();
 
   // get a resource from the pool, or return NULL on failure (i.e.,
-  // we've hit the high watermark)
-  Resource * fetch();
+  // we've hit the high watermark).  virtual, along with release(), so
+  // pools that cache resources in front of this one (see
+  // magazine_resource_pool.hpp) are used the same way through a
+  // reference to the base class.
+  virtual Resource * fetch();
 
   // release a resource back into the pool, and "recycle" it if
   // necessary
-  void release(Resource *r);
-
-  uint32_t allocated() const { return pool.size(); }
-  uint32_t used() const { return allocated() - free(); }
-  uint32_t free() const { return open.size(); }
+  virtual void release(Resource *r);
+
+  // like fetch(), but if we're at the high watermark, wait up to
+  // timeout_ms for a resource to be released.  returns NULL if we
+  // time out.
+  Resource * fetch_wait(uint32_t timeout_ms);
+
+  // like fetch(), but calls cb with the resource once there is one
+  // (possibly right away).  the callback object must stay around until
+  // it's called or canceled.  callbacks still waiting when the pool is
+  // destroyed are never called; threads still in fetch_wait() are
+  // woken up and get NULL.
+  void fetch_async(resource_pool_callback<Resource> *cb);
+
+  // stop waiting for a resource for cb.  returns false if cb has
+  // already been given a resource (or is about to be).
+  bool cancel_async(resource_pool_callback<Resource> *cb);
+
+  // number of threads/callbacks waiting for a resource
+  uint32_t waiting() const { return load_relaxed(&n_waiters); }
+
+  // destroy free resources that have been idle for longer than
+  // seconds when maintain() is called (0, the default, disables idle
+  // expiry)
+  void set_idle_timeout(uint32_t seconds);
+
+  // periodic housekeeping: expire idle resources and re-validate
+  // quarantined ones.  returns the number of resources destroyed.
+  uint32_t maintain();
+
+  // fetch or release up to n resources at once, taking the pool's
+  // mutex only once.  fetch_many returns the number of resources
+  // actually fetched, which is less than n only if we hit the high
+  // watermark (or somebody is waiting in line).
+  uint32_t fetch_many(Resource **out, uint32_t n);
+  void release_many(Resource **in, uint32_t n);
+
+  uint32_t allocated() const { return n_allocated; }
+  uint32_t used() const
+  {
+    return n_allocated - n_open - quarantined.size();
+  }
+  uint32_t free() const { return n_open; }
+  uint32_t quarantine_size() const { return quarantined.size(); }
+  uint32_t low_watermark() const { return wm_low; }
+  uint32_t high_watermark() const { return wm_high; }
 
 protected:
 
   // perform any necessary actions on a newly released resource
   virtual void recycle(Resource *r) {}
 
-  typedef std::list<Resource> resource_list;
-  typedef typename std::list<Resource>::iterator resource_iterator;
+  // check that a resource is still usable before handing it out
+  virtual bool validate(Resource *r) { return true; }
+
+  // take a resource that failed validation out of circulation
+  void quarantine(Resource *r);
+
+  // put resources back on the free list, recycling them first if
+  // asked to, and shrink the pool if the policy says so
+  void put_back(Resource **in, uint32_t n, bool do_recycle);
+
+  // add resources to the free list according to the sizing policy;
+  // returns false if we're at the high watermark.  the mutex must be
+  // held.
+  bool grow_locked();
 
-  uint32_t wm_low, wm_high;
-  resource_list pool;
-  std::list<Resource *> open;
+  // take a resource off the free list, growing if we need to; returns
+  // NULL if we're at the high watermark.  the mutex must be held.
+  Resource * take_locked();
+
+  // wait in line until release() hands us a resource or the deadline
+  // passes.  the mutex must be held.
+  Resource * wait_locked(const struct timespec &deadline);
+
+  // somebody waiting for a resource, either a thread in fetch_wait()
+  // (which waits on cond) or a fetch_async() callback
+  struct resource_waiter
+  {
+    pthread_cond_t cond;
+    resource_pool_callback<Resource> *cb;
+    Resource *r;
+    resource_waiter *prev, *next;
+  };
+
+  void enqueue_waiter(resource_waiter *w);
+  void dequeue_waiter(resource_waiter *w);
+
+  // hand r to the waiter at the head of the line: a fetch_wait()
+  // thread is woken right away, a callback is added to served to be
+  // called (by call_served()) once the mutex has been released.  the
+  // mutex must be held.
+  void serve_locked(Resource *r, std::vector<resource_waiter *> &served);
+  void call_served(const std::vector<resource_waiter *> &served);
+
+  // seconds on CLOCK_MONOTONIC, for idle timestamps
+  static time_t idle_clock()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+  }
+
+  // per-slot bookkeeping kept alongside each resource
+  struct slot_links
+  {
+    time_t released; // when this went on the free list (idle_clock())
+  };
+
+  typedef resource_slab<Resource, slot_links> slab_type;
+  typedef typename slab_type::slot resource_slot;
+
+  // the free list is a ring of slot indices, oldest release at the
+  // front.  the mutex must be held for all of these.
+  uint32_t ring_mask() const { return ring.size() - 1; }
+  uint32_t open_at(uint32_t k) const
+  {
+    return ring[(ring_head + k) & ring_mask()];
+  }
+  void open_push(uint32_t i)
+  {
+    ring[(ring_head + n_open++) & ring_mask()] = i;
+  }
+  uint32_t open_pop_newest()
+  {
+    return ring[(ring_head + --n_open) & ring_mask()];
+  }
+  uint32_t open_pop_oldest()
+  {
+    uint32_t i = ring[ring_head];
+    ring_head = (ring_head + 1) & ring_mask();
+    --n_open;
+    return i;
+  }
+  void reserve_open(uint32_t n);
+
+  // destroy resources (outside the lock) and then give their slots
+  // back to the slab
+  void destroy_slots(const std::vector<uint32_t> &doomed);
+
+  uint32_t wm_low, wm_high, idle_timeout;
+  slab_type slab;
+  uint32_t n_allocated;
+  std::vector<uint32_t> ring;
+  uint32_t ring_head, n_open;
+  std::vector<uint32_t> quarantined;
+  resource_waiter *wait_head, *wait_tail;
+  volatile uint32_t n_waiters;
+  bool closing;            // being destroyed; fetch_wait() gives up
+  pthread_cond_t closed;   // destructor waiting for fetch_wait()s
   pthread_mutex_t mutex;
   Policy policy;
 };
@@ -166,93 +361,468 @@ protected:
 template <class Resource, class Policy>
 resource_pool<Resource, Policy>::resource_pool
   (uint32_t low_watermark, uint32_t high_watermark)
-    : wm_low(low_watermark), wm_high(high_watermark),
-      pool(0)
+    : wm_low(low_watermark), wm_high(high_watermark), idle_timeout(0),
+      n_allocated(0), ring_head(0), n_open(0),
+      wait_head(NULL), wait_tail(NULL), n_waiters(0), closing(false)
 {
   pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&closed, NULL);
 }
 
 template <class Resource, class Policy>
 resource_pool<Resource, Policy>::~resource_pool()
 {
+  {
+    locker L(mutex);
+    closing = true;
+
+    // async waiters are ours to free; fetch_wait() waiters live on
+    // their threads' stacks, so wake them up and wait for them to get
+    // out of line on their own
+    resource_waiter *w = wait_head;
+    while(w) {
+      resource_waiter *next = w->next;
+      if(w->cb) {
+        dequeue_waiter(w);
+        delete w;
+      } else
+        pthread_cond_signal(&w->cond);
+      w = next;
+    }
+
+    while(wait_head)
+      pthread_cond_wait(&closed, &mutex);
+  }
+
+  // the slab destroys whatever resources are left
+  pthread_cond_destroy(&closed);
   pthread_mutex_destroy(&mutex);
 }
 
 template <class Resource, class Policy>
-Resource * resource_pool<Resource, Policy>::fetch()
+bool resource_pool<Resource, Policy>::grow_locked()
+{
+  if(allocated() >= wm_high)
+    return false;
+
+  // we need to allocate more resources (we're not at our high
+  // watermark yet).  ask the pool sizing policy how much we should
+  // grow.
+
+  uint32_t grow = allocated() == 0 ? wm_low :
+    std::min(policy.grow(allocated()), (uint32_t)(wm_high - allocated()));
+  grow = std::max(grow, (uint32_t)1);
+
+  reserve_open(n_allocated + grow);
+
+  time_t now = idle_timeout ? idle_clock() : 0;
+  for(uint32_t n = 0; n < grow; ++n) {
+    // if the constructor throws, the slot has to go back to the slab
+    // or it's lost to the pool for good
+    uint32_t i = slab.allocate();
+    Resource *r;
+    try {
+      r = slab.construct(i);
+    } catch(...) {
+      slab.deallocate(i);
+      throw;
+    }
+    slab[i].links.released = now;
+    ++n_allocated;
+    open_push(i);
+    recycle(r);
+  }
+
+  return true;
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::reserve_open(uint32_t n)
 {
+  if(n <= ring.size())
+    return;
+
+  uint32_t sz = ring.empty() ? 16 : ring.size();
+  while(sz < n)
+    sz *= 2;
+
+  // unwrap the ring into the new one, oldest first
+  std::vector<uint32_t> bigger(sz);
+  for(uint32_t k = 0; k < n_open; ++k)
+    bigger[k] = open_at(k);
+  ring.swap(bigger);
+  ring_head = 0;
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::destroy_slots
+  (const std::vector<uint32_t> &doomed)
+{
+  if(doomed.empty())
+    return;
+
+  for(uint32_t k = 0; k < doomed.size(); ++k)
+    slab.destroy(doomed[k]);
+
   locker L(mutex);
+  for(uint32_t k = 0; k < doomed.size(); ++k)
+    slab.deallocate(doomed[k]);
+}
 
+template <class Resource, class Policy>
+Resource * resource_pool<Resource, Policy>::fetch()
+{
+  Resource *r = NULL;
+  fetch_many(&r, 1);
+  return r;
+}
+
+template <class Resource, class Policy>
+Resource * resource_pool<Resource, Policy>::take_locked()
+{
   // any resources available?
-  if(open.empty() && pool.size() >= wm_high)
+  if(n_open == 0 && !grow_locked())
     return NULL;
 
-  if(open.empty()) {
+  // hand out the most recently released resource
+  return slab[open_pop_newest()].resource();
+}
+
+template <class Resource, class Policy>
+uint32_t resource_pool<Resource, Policy>::fetch_many
+  (Resource **out, uint32_t n)
+{
+  uint32_t got = 0;
+  bool dry = false;
+
+  while(got < n && !dry) {
+
+    uint32_t taken = got;
+    {
+      locker L(mutex);
+      for(; taken < n; ++taken) {
+        // anybody waiting in line gets served first
+        if(wait_head || !(out[taken] = take_locked())) {
+          dry = true;
+          break;
+        }
+      }
+    }
+
+    // validate outside the lock, keeping the good ones; if any were
+    // bad we'll go around again for replacements
+    for(uint32_t i = got; i < taken; ++i) {
+      if(validate(out[i]))
+        out[got++] = out[i];
+      else
+        quarantine(out[i]);
+    }
+  }
+
+  return got;
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::quarantine(Resource *r)
+{
+  locker L(mutex);
+  quarantined.push_back(slab_type::slot_of(r)->index);
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::enqueue_waiter(resource_waiter *w)
+{
+  w->r = NULL;
+  w->next = NULL;
+  w->prev = wait_tail;
+  if(wait_tail)
+    wait_tail->next = w;
+  else
+    wait_head = w;
+  wait_tail = w;
+  store_relaxed(&n_waiters, n_waiters + 1); // read without the lock
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::dequeue_waiter(resource_waiter *w)
+{
+  if(w->prev)
+    w->prev->next = w->next;
+  else
+    wait_head = w->next;
+  if(w->next)
+    w->next->prev = w->prev;
+  else
+    wait_tail = w->prev;
+  store_relaxed(&n_waiters, n_waiters - 1);
+}
+
+template <class Resource, class Policy>
+Resource * resource_pool<Resource, Policy>::fetch_wait(uint32_t timeout_ms)
+{
+  // compute our deadline on the monotonic clock, so setting the
+  // system time doesn't cut the wait short or stretch it out
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  uint64_t nsec = (uint64_t)deadline.tv_nsec +
+    (uint64_t)(timeout_ms % 1000) * 1000000;
+  deadline.tv_sec += timeout_ms / 1000 + nsec / 1000000000;
+  deadline.tv_nsec = nsec % 1000000000;
+
+  while(1) {
+    Resource *r;
+
+    {
+      locker L(mutex);
+
+      // if nobody's ahead of us, try to get one right away (if there
+      // are waiters, the free list is necessarily empty anyway)
+      r = wait_head ? NULL : take_locked();
+      if(!r && timeout_ms > 0)
+        r = wait_locked(deadline);
+    }
 
-    // we need to allocate more resources (we're not at our high
-    // watermark yet).  ask the pool sizing policy how much we should
-    // grow.
+    if(!r || validate(r))
+      return r;
 
-    uint32_t grow = pool.empty() ? wm_low :
-      std::max(std::min(policy.grow(pool.size()),
-                        (uint32_t)(wm_high - pool.size())),
-               (uint32_t)1);
+    quarantine(r);
+  }
+}
+
+template <class Resource, class Policy>
+Resource * resource_pool<Resource, Policy>::wait_locked
+  (const struct timespec &deadline)
+{
+  // get in line; release() will hand us a resource directly
+  resource_waiter w;
+  w.cb = NULL;
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&w.cond, &attr);
+  pthread_condattr_destroy(&attr);
+  enqueue_waiter(&w);
+
+  int rv = 0;
+  while(!w.r && !closing && rv != ETIMEDOUT)
+    rv = pthread_cond_timedwait(&w.cond, &mutex, &deadline);
+
+  // timed out (or the pool is going away) without getting anything?
+  // get out of line.
+  if(!w.r) {
+    dequeue_waiter(&w);
+    if(closing)
+      pthread_cond_signal(&closed);
+  }
 
-    resource_list add(grow);
-    for(resource_iterator i = add.begin(); i != add.end(); ++i) {
-      open.push_back(&(*i));
-      recycle(open.back());
+  pthread_cond_destroy(&w.cond);
+  return w.r;
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::fetch_async
+  (resource_pool_callback<Resource> *cb)
+{
+  Resource *r;
+
+  while(1) {
+    {
+      locker L(mutex);
+      r = wait_head ? NULL : take_locked();
+
+      if(!r) {
+        resource_waiter *w = new resource_waiter;
+        w->cb = cb;
+        enqueue_waiter(w);
+        return;
+      }
     }
-    pool.splice(pool.end(), add);
+
+    if(validate(r))
+      break;
+    quarantine(r);
   }
 
-  // remove a resource from open, put it on closed, and return a
-  // pointer to it
-  Resource *r = open.back();
-  open.pop_back();
-  return r;
+  (*cb)(r);
+}
+
+template <class Resource, class Policy>
+bool resource_pool<Resource, Policy>::cancel_async
+  (resource_pool_callback<Resource> *cb)
+{
+  locker L(mutex);
+
+  for(resource_waiter *w = wait_head; w; w = w->next) {
+    if(w->cb == cb) {
+      dequeue_waiter(w);
+      delete w;
+      return true;
+    }
+  }
+
+  return false;
 }
 
 template <class Resource, class Policy>
 void resource_pool<Resource, Policy>::release(Resource *r)
+{
+  put_back(&r, 1, true);
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::release_many
+  (Resource **in, uint32_t n)
+{
+  put_back(in, n, true);
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::put_back
+  (Resource **in, uint32_t n, bool do_recycle)
+{
+  std::vector<uint32_t> doomed;
+  std::vector<resource_waiter *> served;
+
+  {
+    locker L(mutex);
+    time_t now = idle_timeout ? idle_clock() : 0;
+
+    for(uint32_t i = 0; i < n; ++i) {
+      if(do_recycle)
+        recycle(in[i]);
+
+      // if somebody's waiting, the resource goes straight to them
+      if(wait_head) {
+        serve_locked(in[i], served);
+        continue;
+      }
+
+      // otherwise add the resource back into the free list
+      resource_slot *s = slab_type::slot_of(in[i]);
+      s->links.released = now;
+      open_push(s->index);
+    }
+
+    // should we release some resources?
+    if(n_allocated > wm_low && n_open > 0) {
+
+      uint32_t remove = policy.shrink(n_allocated, n_open);
+      if(n_allocated - remove < wm_low)
+        remove = n_allocated - wm_low;
+
+      // take the resources that have been free the longest off the
+      // front of the ring
+      for(; remove > 0 && n_open > 0; --remove) {
+        doomed.push_back(open_pop_oldest());
+        --n_allocated;
+      }
+    }
+  }
+
+  // destroy removed resources outside the lock
+  destroy_slots(doomed);
+
+  // hand resources off to async waiters
+  call_served(served);
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::serve_locked
+  (Resource *r, std::vector<resource_waiter *> &served)
+{
+  resource_waiter *w = wait_head;
+  dequeue_waiter(w);
+  w->r = r;
+
+  // call callbacks once we've let go of the lock, in order
+  if(w->cb)
+    served.push_back(w);
+  else
+    pthread_cond_signal(&w->cond);
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::call_served
+  (const std::vector<resource_waiter *> &served)
+{
+  for(uint32_t k = 0; k < served.size(); ++k) {
+    resource_waiter *w = served[k];
+    (*w->cb)(w->r);
+    delete w;
+  }
+}
+
+template <class Resource, class Policy>
+void resource_pool<Resource, Policy>::set_idle_timeout(uint32_t seconds)
 {
   locker L(mutex);
 
-  // add the resource back into the free list
-  recycle(r);
-  open.push_back(r);
-
-  // should we release some resources?
-  if(pool.size() > wm_low) {
-
-    uint32_t remove = policy.shrink(pool.size(), open.size());
-    if(remove == 0)
-      return;
-    else if(pool.size() - remove < wm_low)
-      remove = pool.size() - wm_low;
-
-    // just iterate over resources in the pool, look for them in open,
-    // and remove from both pool and open if found.  this is expensive
-    // (O(n^2)) in this implementation, so we want to do it only
-    // rarely.
-    typename std::list<Resource *>::iterator oi;
-    resource_iterator ri = pool.begin();
-    for(; ri != pool.end() && remove; --remove) {
-
-      for(oi = open.begin(); oi != open.end(); ++oi) {
-        if(*oi == &(*ri)) {
-          open.erase(oi);
-          break;
-        }
+  // start everything that's already free off fresh
+  if(seconds && !idle_timeout) {
+    time_t now = idle_clock();
+    for(uint32_t k = 0; k < n_open; ++k)
+      slab[open_at(k)].links.released = now;
+  }
+
+  idle_timeout = seconds;
+}
+
+template <class Resource, class Policy>
+uint32_t resource_pool<Resource, Policy>::maintain()
+{
+  std::vector<uint32_t> doomed, suspects;
+
+  {
+    locker L(mutex);
+
+    // the free list is in order of release time, so the resources
+    // that have been idle the longest are at the front
+    if(idle_timeout) {
+      time_t cutoff = idle_clock() - idle_timeout;
+      while(n_open > 0 && slab[open_at(0)].links.released <= cutoff &&
+            n_allocated > wm_low)
+      {
+        doomed.push_back(open_pop_oldest());
+        --n_allocated;
       }
+    }
 
-      // if we found this resource in open, clobber it
-      if(oi != open.end())
-        ri = pool.erase(ri);
-      else
-        ++ri;
+    // pull everything out of quarantine to check again
+    suspects.swap(quarantined);
+  }
+
+  // re-validate quarantined resources without the lock held;
+  // resources that pass go back in the pool, the rest are destroyed
+  for(uint32_t k = 0; k < suspects.size(); ++k) {
+    Resource *r = slab[suspects[k]].resource();
+    if(validate(r))
+      put_back(&r, 1, true);
+    else {
+      {
+        locker L(mutex);
+        --n_allocated;
+      }
+      doomed.push_back(suspects[k]);
     }
   }
+
+  // destroy expired and bad resources outside the lock
+  destroy_slots(doomed);
+  uint32_t destroyed = doomed.size();
+
+  // that may have left room to grow the pool for anybody still
+  // waiting in line
+  if(destroyed > 0) {
+    std::vector<resource_waiter *> served;
+    {
+      locker L(mutex);
+      while(wait_head && (n_open > 0 || grow_locked()))
+        serve_locked(slab[open_pop_newest()].resource(), served);
+    }
+    call_served(served);
+  }
+
+  return destroyed;
 }
 
 #endif // _KRB_RESOURCE_POOL_HPP
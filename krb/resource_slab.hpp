@@ -0,0 +1,206 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Contiguous storage for pooled resources.  Slots are allocated in
+  fixed-size chunks of 2^ChunkBits, so growing adds one chunk rather
+  than one heap node per resource, and slots are addressed by a
+  32-bit index.  Each slot holds raw storage for one Resource plus a
+  user-defined Links struct (free list links, timestamps, and so on)
+  for the pool that owns the slab.
+
+  Slots come in two states: vacant, or holding a live Resource.
+  Getting a slot and constructing a resource in it are separate
+  steps, so an owner can construct or destroy resources outside its
+  own lock:
+
+    allocate()/deallocate(i): get/return a vacant slot; not thread
+      safe, the owner must serialize these
+    construct(i)/destroy(i): construct/destroy the resource in slot i;
+      touches nothing but the slot itself
+
+  Indexing a slot (operator[]) never blocks and is safe concurrently
+  with allocate(): chunks are never freed while the slab exists, and
+  when the chunk table has to grow, the old table is kept around
+  rather than freed, so a lock-free reader holding an index it got
+  after that slot was allocated can always find it.
+
+  That also means the slab's memory only ever grows: destroying and
+  deallocating resources makes their slots vacant for reuse, but the
+  chunks themselves (and the chunk tables) stay allocated at the
+  slab's high-water mark until the slab is destroyed.  A slot is just
+  a Resource plus its Links, so this is usually small; resources that
+  own large buffers should free them in their destructors.
+
+  The slab destroys any live resources when it's destroyed.
+*/
+
+#ifndef _KRB_RESOURCE_SLAB_HPP
+#define _KRB_RESOURCE_SLAB_HPP
+
+#include <inttypes.h>
+#include <new>
+#include <vector>
+#include <tr1/type_traits>
+
+
+template <class Resource, class Links, uint32_t ChunkBits = 6>
+class resource_slab
+{
+public:
+
+  struct slot
+  {
+    // the storage must come first: we get from a Resource * back to
+    // its slot with a cast
+    typename std::tr1::aligned_storage
+      <sizeof(Resource), std::tr1::alignment_of<Resource>::value>::type
+        storage;
+    uint32_t index;
+    bool live;
+    Links links;
+
+    Resource * resource() { return reinterpret_cast<Resource *>(&storage); }
+  };
+
+  static const uint32_t chunk_size = 1 << ChunkBits;
+
+  resource_slab() : table(NULL), table_size(0), n_slots(0), n_live(0) {}
+  ~resource_slab();
+
+  slot & operator[](uint32_t i)
+  {
+    slot **T = table;
+    return T[i >> ChunkBits][i & (chunk_size - 1)];
+  }
+
+  static slot * slot_of(Resource *r)
+  {
+    return reinterpret_cast<slot *>(r);
+  }
+
+  uint32_t allocate();
+  void deallocate(uint32_t i) { vacant.push_back(i); }
+
+  Resource * construct(uint32_t i);
+  void destroy(uint32_t i);
+
+  // number of slots (vacant or not) and number of live resources
+  uint32_t capacity() const { return n_slots; }
+  uint32_t live() const { return n_live; }
+
+protected:
+
+  resource_slab(const resource_slab &);             // no copying
+  resource_slab & operator=(const resource_slab &);
+
+  slot ** volatile table;
+  uint32_t table_size; // in chunks
+  uint32_t n_slots;
+  volatile uint32_t n_live;
+  std::vector<uint32_t> vacant;
+  std::vector<slot **> old_tables;
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class Resource, class Links, uint32_t ChunkBits>
+resource_slab<Resource, Links, ChunkBits>::~resource_slab()
+{
+  for(uint32_t i = 0; i < n_slots; ++i)
+    if((*this)[i].live)
+      destroy(i);
+
+  for(uint32_t c = 0; c < n_slots / chunk_size; ++c)
+    delete [] table[c];
+  delete [] table;
+
+  for(uint32_t t = 0; t < old_tables.size(); ++t)
+    delete [] old_tables[t];
+}
+
+template <class Resource, class Links, uint32_t ChunkBits>
+uint32_t resource_slab<Resource, Links, ChunkBits>::allocate()
+{
+  if(vacant.empty()) {
+
+    // out of slots; add a chunk, first growing the chunk table if
+    // it's full
+    uint32_t c = n_slots / chunk_size;
+    if(c == table_size) {
+      uint32_t new_size = table_size ? 2 * table_size : 4;
+      slot **T = new slot * [new_size];
+      for(uint32_t j = 0; j < table_size; ++j)
+        T[j] = table[j];
+      if(table)
+        old_tables.push_back((slot **)table);
+      __sync_synchronize();
+      table = T;
+      table_size = new_size;
+    }
+
+    slot *C = new slot[chunk_size];
+    for(uint32_t j = 0; j < chunk_size; ++j) {
+      C[j].index = n_slots + j;
+      C[j].live = false;
+    }
+    __sync_synchronize();
+    table[c] = C;
+
+    // hand out the lowest indices first
+    for(uint32_t j = chunk_size; j > 0; --j)
+      vacant.push_back(n_slots + j - 1);
+    n_slots += chunk_size;
+  }
+
+  uint32_t i = vacant.back();
+  vacant.pop_back();
+  return i;
+}
+
+template <class Resource, class Links, uint32_t ChunkBits>
+Resource * resource_slab<Resource, Links, ChunkBits>::construct(uint32_t i)
+{
+  slot &s = (*this)[i];
+  new (&s.storage) Resource();
+  s.live = true;
+  __sync_fetch_and_add(&n_live, 1);
+  return s.resource();
+}
+
+template <class Resource, class Links, uint32_t ChunkBits>
+void resource_slab<Resource, Links, ChunkBits>::destroy(uint32_t i)
+{
+  slot &s = (*this)[i];
+  s.resource()->~Resource();
+  s.live = false;
+  __sync_fetch_and_sub(&n_live, 1);
+}
+
+#endif // _KRB_RESOURCE_SLAB_HPP
@@ -29,6 +29,21 @@
   the ring start), and write directly into the buffer (after which
   you're required to advance the buffer's end counter yourself by
   calling write_advance).
+
+  write_overwrite() never fails: if there isn't room, it drops the
+  oldest elements to make some, which is what you want for keeping
+  the last N of something around (see also lossy_ring.hpp for a
+  version multiple threads can write to at once).
+
+  read_from_fd() and write_to_fd() move data between the ring and a
+  file descriptor with a single readv()/writev() covering both halves
+  of the ring if they need to, so there's no intermediate buffer and
+  no second system call when the data wraps.  They're meant for byte
+  rings (T = char or similar).  Both return what the system call
+  returned: the number of bytes moved (0 on end-of-file for
+  read_from_fd), or -1 with errno set --- including EAGAIN for
+  non-blocking descriptors that aren't ready.  Interrupted calls are
+  retried.  read_from_fd() fails with ENOBUFS if the ring is full.
 */
 
 #ifndef _KRB_RING_BUFFER_HPP
@@ -36,6 +51,10 @@
 
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 template <class T>
 class ring_buffer
@@ -52,6 +71,16 @@ public:
   bool write(const T *in, uint32_t n);
   bool write_advance(uint32_t n);
 
+  // write, dropping the oldest elements if necessary to make room;
+  // returns the number of elements dropped.  if n is larger than the
+  // ring, only the last size elements of in are kept.
+  uint32_t write_overwrite(const T *in, uint32_t n);
+
+  // read up to max bytes from fd into the ring / write up to max
+  // bytes from the ring to fd
+  ssize_t read_from_fd(int fd, uint32_t max);
+  ssize_t write_to_fd(int fd, uint32_t max);
+
   uint32_t used() const { return count; }
   uint32_t available() const { return buf_sz - count; }
   uint32_t available_contiguous() const;
@@ -187,4 +216,92 @@ bool ring_buffer<T>::write(const T *in, uint32_t n)
   return write_advance(n);
 }
 
+template <class T>
+uint32_t ring_buffer<T>::write_overwrite(const T *in, uint32_t n)
+{
+  uint32_t dropped = 0;
+
+  if(n > buf_sz) {
+    dropped = n - buf_sz;
+    in += dropped;
+    n = buf_sz;
+  }
+
+  if(n > available()) {
+    const uint32_t old = n - available();
+    read_advance(old);
+    dropped += old;
+  }
+
+  write(in, n);
+  return dropped;
+}
+
+template <class T>
+ssize_t ring_buffer<T>::read_from_fd(int fd, uint32_t max)
+{
+  uint32_t n = available() < max ? available() : max;
+  if(n == 0) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  // the free space runs from <end> either to <start> or to the end of
+  // the buffer and then around from the beginning to <start>
+  struct iovec iov[2];
+  int iovcnt = 1;
+  const uint32_t end_chunk_size = available_contiguous();
+  iov[0].iov_base = end;
+  if(end_chunk_size >= n)
+    iov[0].iov_len = n*sizeof(T);
+  else {
+    iov[0].iov_len = end_chunk_size*sizeof(T);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = (n-end_chunk_size)*sizeof(T);
+    iovcnt = 2;
+  }
+
+  ssize_t rv;
+  do {
+    rv = readv(fd, iov, iovcnt);
+  } while(rv < 0 && errno == EINTR);
+
+  if(rv > 0)
+    write_advance(rv / sizeof(T));
+  return rv;
+}
+
+template <class T>
+ssize_t ring_buffer<T>::write_to_fd(int fd, uint32_t max)
+{
+  uint32_t n = count < max ? count : max;
+  if(n == 0)
+    return 0;
+
+  // the data runs from <start> either to <end> or to the end of the
+  // buffer and then around from the beginning to <end>
+  struct iovec iov[2];
+  int iovcnt = 1;
+  const uint32_t end_chunk_size =
+    start < end ? count : (last - start) / sizeof(T);
+  iov[0].iov_base = start;
+  if(end_chunk_size >= n)
+    iov[0].iov_len = n*sizeof(T);
+  else {
+    iov[0].iov_len = end_chunk_size*sizeof(T);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = (n-end_chunk_size)*sizeof(T);
+    iovcnt = 2;
+  }
+
+  ssize_t rv;
+  do {
+    rv = writev(fd, iov, iovcnt);
+  } while(rv < 0 && errno == EINTR);
+
+  if(rv > 0)
+    read_advance(rv / sizeof(T));
+  return rv;
+}
+
 #endif // _KRB_RING_BUFFER_HPP
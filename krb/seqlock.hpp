@@ -0,0 +1,204 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Sequence locks, for small values that are read very often and
+  written rarely: the current time, a snapshot of some counters, a
+  tiny config struct.  Readers never write to shared memory at all, so
+  any number of them can read at once without slowing each other
+  down; instead, a reader checks a sequence number before and after
+  reading and tries again if a writer was active in between.  Writers
+  make the sequence number odd while they work and bump it back to
+  even when they're done.  Writers never wait for readers, though
+  readers may have to retry (or spin) while a write is in progress,
+  so keep writes short and infrequent.
+
+  seqlock<T> wraps a value: store() writes it and load() returns a
+  consistent copy.  T must be trivially copyable (memcpy-able); it's
+  copied in and out a machine word at a time with relaxed atomic loads
+  and stores, so concurrent reads and writes are not data races.
+  Multiple writers are fine; they take turns.
+
+  seqcount is the bare sequence number, for protecting data of your
+  own.  Write with a seq_write_locker held:
+
+    {
+      seq_write_locker W(sc);
+      ...update the data...
+    }
+
+  and read in a retry loop:
+
+    uint32_t s;
+    do {
+      s = sc.read_begin();
+      ...copy the data out...
+    } while(sc.read_retry(s));
+
+  Readers must not act on what they read until read_retry() says it
+  was consistent, and the data itself should be read and written
+  through volatile or atomic accesses (load_relaxed/store_relaxed in
+  atomic_ops.hpp), since readers really do race with writers.
+*/
+
+#ifndef _KRB_SEQLOCK_HPP
+#define _KRB_SEQLOCK_HPP
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <krb/atomic_ops.hpp>
+
+class seqcount
+{
+public:
+
+  seqcount() : seq(0) {}
+
+  // start reading; waits out any write in progress
+  uint32_t read_begin() const
+  {
+    uint32_t s;
+    while((s = load_acquire(&seq)) & 1)
+      cpu_relax();
+    return s;
+  }
+
+  // finish reading; returns true if a write happened since
+  // read_begin() returned start, in which case you need to try again
+  bool read_retry(uint32_t start) const
+  {
+    // our reads of the data have to complete before we look at the
+    // sequence number again
+    acquire_fence();
+    return load_relaxed(&seq) != start;
+  }
+
+  void write_begin()
+  {
+    // take turns with other writers: make the sequence number odd,
+    // starting from an even one
+    while(1) {
+      uint32_t s = load_relaxed(&seq);
+      if(!(s & 1) && __sync_bool_compare_and_swap(&seq, s, s + 1))
+        break;
+      cpu_relax();
+    }
+    // (the compare-and-swap is a full barrier, so none of our writes
+    // to the data can be seen before the sequence number is odd)
+  }
+
+  void write_end()
+  {
+    // all our writes to the data are visible before the sequence
+    // number is even again
+    store_release(&seq, load_relaxed(&seq) + 1);
+  }
+
+  // for the curious: changes by 2 with every write
+  uint32_t sequence() const { return load_acquire(&seq); }
+
+protected:
+  volatile uint32_t seq;
+};
+
+
+class seq_write_locker
+{
+public:
+
+  seq_write_locker(seqcount &sc)
+    : S(sc)
+  {
+    S.write_begin();
+  }
+
+  ~seq_write_locker()
+  {
+    S.write_end();
+  }
+
+protected:
+  seqcount &S;
+
+};
+
+
+template <class T>
+class seqlock
+{
+public:
+
+  seqlock() { memset((void *)words, 0, sizeof(words)); }
+  seqlock(const T &v) { store(v); }
+
+  void store(const T &v);
+  T load() const;
+
+protected:
+
+  static const uint32_t n_words =
+    (sizeof(T) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+
+  seqcount sc;
+  volatile uintptr_t words[n_words];
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class T>
+void seqlock<T>::store(const T &v)
+{
+  uintptr_t w[n_words];
+  w[n_words - 1] = 0; // don't copy uninitialized padding
+  memcpy(w, &v, sizeof(T));
+
+  seq_write_locker W(sc);
+  for(uint32_t i = 0; i < n_words; ++i)
+    store_relaxed(&words[i], w[i]);
+}
+
+template <class T>
+T seqlock<T>::load() const
+{
+  uintptr_t w[n_words];
+  uint32_t s;
+
+  do {
+    s = sc.read_begin();
+    for(uint32_t i = 0; i < n_words; ++i)
+      w[i] = load_relaxed(&words[i]);
+  } while(sc.read_retry(s));
+
+  T v;
+  memcpy(&v, w, sizeof(T));
+  return v;
+}
+
+#endif // _KRB_SEQLOCK_HPP
@@ -0,0 +1,354 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A single-producer/single-consumer ring buffer that's safe to share
+  between two threads without a lock: one thread may only write, the
+  other may only read.  It has the same interface as ring_buffer
+  (read, peek, write, and direct writes followed by write_advance),
+  plus direct reads followed by read_advance, so a reader thread can
+  recv() straight into the buffer and a parser thread can parse
+  straight out of it.
+
+  The read and write positions are free-running 32-bit counters that
+  are masked to index the buffer, so the capacity is rounded up to a
+  power of two.  Each side publishes its position with a release
+  store and reads the other's with an acquire load, and the two
+  positions live on separate cache lines.  Each side also keeps a
+  private copy of the other's position and only goes back to the
+  shared one when its copy says there isn't enough room (or data),
+  so in steady state the two threads rarely touch each other's cache
+  lines.
+
+  wait_readable() and wait_writable() block the reader (writer) until
+  there's enough data (room), spinning briefly and then sleeping on a
+  futex on the other side's position counter.  The other side only
+  makes the wake-up system call when somebody is actually asleep, so a
+  busy pipeline makes no system calls and an idle one uses no CPU.
+  The barrier that handshake needs is also paid by the side going to
+  sleep (see light_fence() in futex.hpp), so publishing a position
+  stays a plain store.
+
+  Like ring_buffer, elements are moved with memcpy, so T should be a
+  plain old data type.
+
+  used(), available(), and friends are exact when called by the
+  reader (for used) or the writer (for available); from anywhere else
+  they're just a recent snapshot.
+*/
+
+#ifndef _KRB_SPSC_RING_BUFFER_HPP
+#define _KRB_SPSC_RING_BUFFER_HPP
+
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <krb/atomic_ops.hpp>
+#include <krb/futex.hpp>
+
+template <class T>
+class spsc_ring_buffer
+{
+public:
+  // size is rounded up to a power of two
+  spsc_ring_buffer(uint32_t size);
+  ~spsc_ring_buffer();
+
+  // reader side
+  bool read(T *out, uint32_t n);
+  bool peek(T *out, uint32_t n);
+  bool read_advance(uint32_t n);
+  const T * read_direct_access() const { return buf + (head & mask); }
+  uint32_t used_contiguous() const;
+
+  // wait until at least min elements can be read, or timeout_ms
+  // passes (negative: forever, 0: don't wait).  returns false on
+  // timeout.
+  bool wait_readable(uint32_t min, int32_t timeout_ms = -1);
+
+  // writer side
+  T * write_direct_access() { return buf + (tail & mask); }
+  bool write(const T *in, uint32_t n);
+  bool write_advance(uint32_t n);
+  uint32_t available_contiguous() const;
+
+  // wait until at least min elements can be written (see
+  // wait_readable)
+  bool wait_writable(uint32_t min, int32_t timeout_ms = -1);
+
+  uint32_t used() const
+  {
+    return load_acquire(&tail) - load_acquire(&head);
+  }
+  uint32_t available() const { return buf_sz - used(); }
+  uint32_t capacity() const { return buf_sz; }
+  bool full() const { return used() == buf_sz; }
+  bool empty() const { return used() == 0; }
+
+protected:
+
+  spsc_ring_buffer(const spsc_ring_buffer &);             // no copying
+  spsc_ring_buffer & operator=(const spsc_ring_buffer &);
+
+  // make sure there are at least n elements to read/slots to write,
+  // refreshing our copy of the other side's position if needed
+  bool readable(uint32_t n);
+  bool writable(uint32_t n);
+
+  // copy n elements between the ring (starting at position pos) and
+  // a flat array, in one or two pieces
+  void copy_out(uint32_t pos, T *out, uint32_t n) const;
+  void copy_in(uint32_t pos, const T *in, uint32_t n);
+
+  // sleep until *pos (tail or head) moves, or the deadline passes.
+  // returns false on timeout.
+  bool park(volatile uint32_t *pos, volatile uint32_t *waiters,
+            uint32_t seen, const struct timespec *deadline);
+
+  // publish a new head/tail and wake up the other side if it's asleep
+  void publish(volatile uint32_t *pos, volatile uint32_t *waiters,
+               uint32_t value)
+  {
+    store_release(pos, value);
+    // our store has to be visible before we look for waiters (who
+    // check the position after announcing themselves); park() pays
+    // for most of that with heavy_fence()
+    light_fence();
+    if(load_relaxed(waiters))
+      futex_wake(pos);
+  }
+
+  T *buf;
+  uint32_t buf_sz, mask;
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint32_t head; // next element to read; written by the reader
+  uint32_t cached_tail;   // reader's copy of tail
+  volatile uint32_t write_waiters; // writers asleep waiting on head
+
+  char pad1[KRB_CACHE_LINE];
+  volatile uint32_t tail; // next slot to write; written by the writer
+  uint32_t cached_head;   // writer's copy of head
+  volatile uint32_t read_waiters; // readers asleep waiting on tail
+
+  char pad2[KRB_CACHE_LINE];
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+template <class T>
+spsc_ring_buffer<T>::spsc_ring_buffer(uint32_t size)
+  : head(0), cached_tail(0), write_waiters(0),
+    tail(0), cached_head(0), read_waiters(0)
+{
+  buf_sz = 1;
+  while(buf_sz < size)
+    buf_sz <<= 1;
+  mask = buf_sz - 1;
+  buf = new T[buf_sz];
+}
+
+template <class T>
+spsc_ring_buffer<T>::~spsc_ring_buffer()
+{
+  delete [] buf;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::readable(uint32_t n)
+{
+  if(cached_tail - head >= n)
+    return true;
+  cached_tail = load_acquire(&tail);
+  return cached_tail - head >= n;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::writable(uint32_t n)
+{
+  if(buf_sz - (tail - cached_head) >= n)
+    return true;
+  cached_head = load_acquire(&head);
+  return buf_sz - (tail - cached_head) >= n;
+}
+
+template <class T>
+uint32_t spsc_ring_buffer<T>::used_contiguous() const
+{
+  uint32_t h = head;
+  return std::min(load_acquire(&tail) - h, buf_sz - (h & mask));
+}
+
+template <class T>
+uint32_t spsc_ring_buffer<T>::available_contiguous() const
+{
+  uint32_t t = tail;
+  return std::min(buf_sz - (t - load_acquire(&head)), buf_sz - (t & mask));
+}
+
+template <class T>
+void spsc_ring_buffer<T>::copy_out(uint32_t pos, T *out, uint32_t n) const
+{
+  const uint32_t i = pos & mask;
+  const uint32_t end_chunk_size = buf_sz - i;
+  if(end_chunk_size >= n)
+    memcpy(out, buf + i, n*sizeof(T));
+  else {
+    memcpy(out, buf + i, end_chunk_size*sizeof(T));
+    memcpy(out + end_chunk_size, buf, (n-end_chunk_size)*sizeof(T));
+  }
+}
+
+template <class T>
+void spsc_ring_buffer<T>::copy_in(uint32_t pos, const T *in, uint32_t n)
+{
+  const uint32_t i = pos & mask;
+  const uint32_t end_chunk_size = buf_sz - i;
+  if(end_chunk_size >= n)
+    memcpy(buf + i, in, n*sizeof(T));
+  else {
+    memcpy(buf + i, in, end_chunk_size*sizeof(T));
+    memcpy(buf, in + end_chunk_size, (n-end_chunk_size)*sizeof(T));
+  }
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::peek(T *out, uint32_t n)
+{
+  if(!readable(n))
+    return false;
+  copy_out(head, out, n);
+  return true;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::read_advance(uint32_t n)
+{
+  if(!readable(n))
+    return false;
+  // release: we're done with the slots, so the writer may reuse them
+  publish(&head, &write_waiters, head + n);
+  return true;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::read(T *out, uint32_t n)
+{
+  return (peek(out, n) && read_advance(n));
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::write_advance(uint32_t n)
+{
+  if(!writable(n))
+    return false;
+  // release: the data we wrote is visible before the new tail is
+  publish(&tail, &read_waiters, tail + n);
+  return true;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::write(const T *in, uint32_t n)
+{
+  if(!writable(n))
+    return false;
+  copy_in(tail, in, n);
+  publish(&tail, &read_waiters, tail + n);
+  return true;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::park
+  (volatile uint32_t *pos, volatile uint32_t *waiters, uint32_t seen,
+   const struct timespec *deadline)
+{
+  __sync_fetch_and_add(waiters, 1);
+  heavy_fence();
+
+  // the other side checks for waiters after moving its position, so
+  // if it hasn't moved by now, it will wake us when it does
+  int rv = 0;
+  if(load_acquire(pos) == seen)
+    rv = futex_wait(pos, seen, deadline);
+
+  __sync_fetch_and_sub(waiters, 1);
+  return !(rv < 0 && errno == ETIMEDOUT);
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::wait_readable(uint32_t min, int32_t timeout_ms)
+{
+  if(min > buf_sz)
+    return false;
+
+  struct timespec deadline;
+  if(timeout_ms > 0)
+    futex_deadline(deadline, timeout_ms);
+
+  for(uint32_t spins = 0; !readable(min); ++spins) {
+    if(timeout_ms == 0)
+      return false;
+    if(spins < 100) {
+      cpu_relax();
+      continue;
+    }
+    if(!park(&tail, &read_waiters, cached_tail,
+             timeout_ms > 0 ? &deadline : NULL))
+      return readable(min);
+  }
+
+  return true;
+}
+
+template <class T>
+bool spsc_ring_buffer<T>::wait_writable(uint32_t min, int32_t timeout_ms)
+{
+  if(min > buf_sz)
+    return false;
+
+  struct timespec deadline;
+  if(timeout_ms > 0)
+    futex_deadline(deadline, timeout_ms);
+
+  for(uint32_t spins = 0; !writable(min); ++spins) {
+    if(timeout_ms == 0)
+      return false;
+    if(spins < 100) {
+      cpu_relax();
+      continue;
+    }
+    if(!park(&head, &write_waiters, cached_head,
+             timeout_ms > 0 ? &deadline : NULL))
+      return writable(min);
+  }
+
+  return true;
+}
+
+#endif // _KRB_SPSC_RING_BUFFER_HPP
@@ -26,7 +26,16 @@
 #ifndef _KRB_SYNCHRONIZER_HPP
 #define _KRB_SYNCHRONIZER_HPP
 
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <new>
 #include <krb/exceptions.hpp>
+#include <krb/atomic_ops.hpp>
+#include <krb/locker.hpp>
+#include <krb/futex.hpp>
 
 class synchronizer_t
 {
@@ -137,4 +146,218 @@ protected:
 
 };
 
+
+/*
+  A quiescent-state-based (QSBR) alternative to synchronizer_t.
+  Instead of stopping every worker at a barrier while the writer
+  replaces shared data, the writer publishes the new data (e.g., by
+  swapping a pointer), calls synchronize() to wait out a "grace
+  period," and then frees the old data.  Workers never block: each one
+  calls quiescent() at points where it holds no references to shared
+  data (the top of its processing loop, where it used to call
+  wait_for_updates()), which is just a store to its own cache line
+  plus a couple of loads from a line they all share and rarely write.
+  A grace period is over once every worker has passed a quiescent
+  point, so none of them can still be looking at the old data.
+
+  synchronize() spins briefly and then sleeps on a futex.  While it's
+  asleep, each worker that passes a quiescent point wakes it up to check
+  again and yields the CPU, so that the writer gets to run at once even
+  when there are more threads than CPUs.  Workers make no system calls
+  unless a writer is actually asleep.
+
+  A worker that's about to block (waiting for input, say) should call
+  offline() first and online() when it comes back, or synchronize()
+  will wait for it.  Between online() and the next quiescent(), and
+  between quiescent() calls, the worker may freely read shared data
+  with no further overhead.
+
+    qsbr_synchronizer_t S(max_workers);
+
+    // worker
+    int me = S.add_thread();
+    while(running) {
+      S.quiescent(me);
+      config *c = load_acquire(&shared_config);
+      ... use c ...
+    }
+    S.remove_thread(me);
+
+    // writer
+    S.update(shared_config, new_config); // publish, wait, delete old
+
+  Writers may call synchronize() concurrently; they're serialized.
+*/
+class qsbr_synchronizer_t
+{
+public:
+
+  qsbr_synchronizer_t(int max_threads);
+  ~qsbr_synchronizer_t();
+
+  // register the calling worker, which starts out online.  returns
+  // the worker's id, to be passed to the calls below.
+  int add_thread();
+  void remove_thread(int id);
+
+  // the worker holds no references to shared data
+  void quiescent(int id)
+  {
+    store_release(&slots[id].counter, load_acquire(&grace_counter));
+    wake_writer();
+  }
+
+  // the worker is going to be away a while (and holds no references)
+  void offline(int id)
+  {
+    store_release(&slots[id].counter, (uint64_t)0);
+    wake_writer();
+  }
+
+  void online(int id)
+  {
+    store_relaxed(&slots[id].counter, load_acquire(&grace_counter));
+    full_barrier(); // writers must see us before we read shared data
+  }
+
+  // wait until every online worker has passed a quiescent point.  a
+  // worker must not call this on itself while online.
+  void synchronize();
+
+  // publish fresh in place of shared, wait a grace period, and delete
+  // the old value
+  template <class T>
+  void update(T * volatile &shared, T *fresh)
+  {
+    // swap atomically, so concurrent updates each delete a different
+    // old value
+    T *old;
+    do
+      old = shared;
+    while(!__sync_bool_compare_and_swap(&shared, old, fresh));
+
+    synchronize();
+    delete old;
+  }
+
+protected:
+
+  qsbr_synchronizer_t(const qsbr_synchronizer_t &);   // no copying
+  qsbr_synchronizer_t & operator=(const qsbr_synchronizer_t &);
+
+  // if synchronize() is asleep, get it to check the slots again, and
+  // give it our CPU in case it's waiting for one.  the slot store has
+  // to be visible before we look at writer_waiting; the writer pays
+  // for most of that (see light_fence() in futex.hpp).
+  void wake_writer()
+  {
+    light_fence();
+    if(load_relaxed(&writer_waiting)) {
+      __sync_fetch_and_add(&wake_seq, 1);
+      futex_wake(&wake_seq);
+      sched_yield();
+    }
+  }
+
+  struct thread_slot
+  {
+    // 0 if offline, otherwise the grace period counter as of the
+    // thread's last quiescent point
+    volatile uint64_t counter;
+    volatile uint32_t in_use;
+    char pad[KRB_CACHE_LINE - sizeof(uint64_t) - sizeof(uint32_t)];
+  };
+
+  char pad0[KRB_CACHE_LINE];
+  volatile uint64_t grace_counter;
+  volatile uint32_t writer_waiting; // synchronize() is asleep on wake_seq
+  volatile uint32_t wake_seq;
+  char pad1[KRB_CACHE_LINE];
+
+  thread_slot *slots;
+  int n_slots;
+  pthread_mutex_t update_mutex;
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+inline qsbr_synchronizer_t::qsbr_synchronizer_t(int max_threads)
+  : grace_counter(1), writer_waiting(0), wake_seq(0),
+    n_slots(max_threads > 0 ? max_threads : 1)
+{
+  // each worker gets a cache line to itself
+  void *mem;
+  if(posix_memalign(&mem, KRB_CACHE_LINE, n_slots * sizeof(thread_slot)))
+    throw std::bad_alloc();
+  slots = (thread_slot *)mem;
+  for(int i = 0; i < n_slots; ++i) {
+    slots[i].counter = 0;
+    slots[i].in_use = 0;
+  }
+
+  pthread_mutex_init(&update_mutex, NULL);
+}
+
+inline qsbr_synchronizer_t::~qsbr_synchronizer_t()
+{
+  pthread_mutex_destroy(&update_mutex);
+  free(slots);
+}
+
+inline int qsbr_synchronizer_t::add_thread()
+{
+  for(int i = 0; i < n_slots; ++i)
+    if(__sync_bool_compare_and_swap(&slots[i].in_use, 0, 1)) {
+      online(i);
+      return i;
+    }
+
+  throw string_exception
+    ("Attempt to add more threads than a"
+     " qsbr_synchronizer_t was created for");
+}
+
+inline void qsbr_synchronizer_t::remove_thread(int id)
+{
+  offline(id);
+  store_release(&slots[id].in_use, (uint32_t)0);
+}
+
+inline void qsbr_synchronizer_t::synchronize()
+{
+  locker L(update_mutex);
+
+  // start a new grace period (this is a full barrier, so whatever the
+  // caller published is visible before it)
+  uint64_t target = __sync_add_and_fetch(&grace_counter, 1);
+
+  for(int i = 0; i < n_slots; ++i) {
+    uint32_t spins = 0;
+    while(1) {
+      uint64_t c = load_acquire(&slots[i].counter);
+      if(c == 0 || c >= target)
+        break;
+
+      if(spins < 100)
+        cpu_relax();
+      else {
+        // announce ourselves, then check once more before sleeping;
+        // any quiescent() or offline() from here on will wake us
+        uint32_t seq = load_acquire(&wake_seq);
+        store_relaxed(&writer_waiting, (uint32_t)1);
+        heavy_fence();
+        c = load_acquire(&slots[i].counter);
+        if(c != 0 && c < target)
+          futex_wait(&wake_seq, seq);
+        store_relaxed(&writer_waiting, (uint32_t)0);
+      }
+      ++spins;
+    }
+  }
+}
+
 #endif // _KRB_SYNCHRONIZER_HPP
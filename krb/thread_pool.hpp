@@ -40,6 +40,16 @@
   actual blocking processing) and a callback() function (which is
   called when the job completes).  A job object can use data members
   to specify input data and store output data as appropriate.
+
+  If jobs need expensive per-thread resources (database connections,
+  zlib streams, scratch buffers), pass a thread_pool_context_factory
+  to the thread_pool.  Each worker thread then gets its own context
+  object, created by the factory in the worker thread just before the
+  worker's first job, and destroyed along with the worker.  Jobs that
+  override run_with(thread_pool_context *) get the context of the
+  worker they're running on.  Every time a worker is returned to the pool,
+  its context is passed to the factory's recycle() so it can be reset
+  for the next job.
 */
 
 #ifndef _KRB_THREAD_POOL_HPP
@@ -58,14 +68,36 @@
 #include <krb/exceptions.hpp>
 
 
+// base class for per-worker context objects
+struct thread_pool_context
+{
+  virtual ~thread_pool_context() {}
+};
+
+// creates, recycles, and destroys per-worker contexts.  create() is
+// called in the worker thread and should return NULL rather than
+// throw on failure (jobs then get a NULL context).  recycle() and
+// destroy() are called from the thread that owns the thread pool,
+// while the worker is idle.
+struct thread_pool_context_factory
+{
+  virtual ~thread_pool_context_factory() {}
+  virtual thread_pool_context * create() = 0;
+  virtual void recycle(thread_pool_context *ctx) {}
+  virtual void destroy(thread_pool_context *ctx) { delete ctx; }
+};
+
 // base job class: you must derive from this to specify jobs for the
-// thread pool.  set priority however makes sense for your
+// thread pool.  override run(), and also run_with(ctx) if the job
+// needs the per-worker context (the pool calls run_with(), which just
+// calls run() by default).  set priority however makes sense for your
 // application.
 struct thread_pool_job
 {
   thread_pool_job() : priority(0) {}
   virtual ~thread_pool_job() {}
   virtual void run() = 0;
+  virtual void run_with(thread_pool_context *ctx) { run(); }
   virtual void callback() {}
   int priority;
 };
@@ -94,12 +126,27 @@ public:
 
   thread_pool
     (uint32_t low_watermark, uint32_t high_watermark,
-     struct event_base *ev_base);
+     struct event_base *ev_base,
+     thread_pool_context_factory *context_factory = NULL);
   ~thread_pool();
 
   bool schedule(thread_pool_job *job);
   uint32_t pending() const { return todo.size(); }
 
+  // number of jobs that could be started right now without queueing
+  // (free threads plus however many more we're allowed to create)
+  uint32_t idle_threads() const
+  {
+    return pool->high_watermark() - pool->used();
+  }
+
+  // release threads whose jobs have finished back into the pool and
+  // call the jobs' callbacks.  this normally happens from the libevent
+  // callback, but can be called directly (from the same thread that
+  // runs the event loop) by code that blocks without returning to the
+  // event loop, e.g., parallel_for.
+  void process_completed();
+
 protected:
 
   bool run_some_jobs();
@@ -147,8 +194,10 @@ struct thread_pool_worker
   // set by the resource pool's recycler
   int fd;
   thread_pool_completed_queue *Q;
+  thread_pool_context_factory *factory;
 
   // managed by this class
+  thread_pool_context *ctx;
   thread_pool_job *current_job;
   pthread_t tid;
   pthread_mutex_t job_mutex;
@@ -165,19 +214,24 @@ protected:
   typedef resource_pool<thread_pool_worker, Policy> base;
   int fd;
   thread_pool_completed_queue &Q;
+  thread_pool_context_factory *factory;
 
   virtual void recycle(thread_pool_worker *w)
   {
     w->fd = fd;
     w->Q = &Q;
+    w->factory = factory;
+    if(w->ctx)
+      factory->recycle(w->ctx);
   }
 
 public:
   thread_resource_pool
     (uint32_t low_watermark, uint32_t high_watermark,
-     int pipefd, thread_pool_completed_queue &queue)
+     int pipefd, thread_pool_completed_queue &queue,
+     thread_pool_context_factory *context_factory)
       : base(low_watermark, high_watermark),
-        fd(pipefd), Q(queue) {}
+        fd(pipefd), Q(queue), factory(context_factory) {}
 };
 
 
@@ -192,7 +246,8 @@ void thread_pool_catch(int fd, short event, void *arg);
 template <class Policy>
 thread_pool<Policy>::thread_pool
   (uint32_t low_watermark, uint32_t high_watermark,
-   struct event_base *ev_base)
+   struct event_base *ev_base,
+   thread_pool_context_factory *context_factory)
     : evbase(ev_base)
 {
   // create the pipe for communication from our worker threads, and
@@ -209,7 +264,7 @@ thread_pool<Policy>::thread_pool
 
   // create the pool of threads
   pool = new thread_resource_pool<Policy>
-    (low_watermark, high_watermark, pipefd[1], done);
+    (low_watermark, high_watermark, pipefd[1], done, context_factory);
 
   // set up a libevent callback for completed jobs
   event_set(&ev, pipefd[0], EV_READ | EV_PERSIST,
@@ -269,6 +324,27 @@ bool thread_pool<Policy>::run_some_jobs()
   return true;
 }
 
+template <class Policy>
+void thread_pool<Policy>::process_completed()
+{
+  {
+    // lock completed jobs queue
+    locker L(done.mutex);
+
+    // pop items from the queue, release the associated threads back
+    // into the pool, and call callbacks
+    while(!done.empty()) {
+      pool->release(done.front().second);
+      done.front().first->callback();
+      done.pop();
+    }
+  }
+
+  // some threads were freed up; try run some jobs in case we have any
+  // waiting
+  run_some_jobs();
+}
+
 // thread_pool event callback for completed jobs
 template <class Policy>
 void thread_pool_catch
@@ -285,22 +361,8 @@ void thread_pool_catch
 
   if(n < 0 && errno != EAGAIN)
     throw strerror_exception("Failed reading from thread pool pipe", errno);
-  else {
-    // lock completed jobs queue
-    locker L(P->done.mutex);
 
-    // pop items from the queue, release the associated threads back
-    // into the pool, and call callbacks
-    while(!P->done.empty()) {
-      P->pool->release(P->done.front().second);
-      P->done.front().first->callback();
-      P->done.pop();
-    }
-  }
-
-  // some threads were freed up; try run some jobs in case we have any
-  // waiting
-  P->run_some_jobs();
+  P->process_completed();
 }
 
 
@@ -308,6 +370,11 @@ void thread_pool_catch
 // thread_pool_worker implementation details
 
 // the actual worker thread function
+static void thread_pool_worker_unlock(void *arg)
+{
+  pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
 void * thread_pool_worker_thread(void *arg)
 {
   thread_pool_worker *W = (thread_pool_worker *)arg;
@@ -316,36 +383,47 @@ void * thread_pool_worker_thread(void *arg)
   // allow ourselves to be canceled
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
 
-  // first time through, we need to lock our condition variable's
-  // mutex
+  // we hold our condition variable's mutex except while running a
+  // job; make sure it gets unlocked if we're canceled while waiting
   pthread_mutex_lock(&W->job_mutex);
+  pthread_cleanup_push(thread_pool_worker_unlock, &W->job_mutex);
 
   while(1) {
 
-    // wait for a new job to arrive
-    pthread_cond_wait(&W->job_cond, &W->job_mutex);
+    // wait for a new job to arrive.  we check current_job rather than
+    // just waiting, since the controlling thread may have handed us a
+    // job before we ever got here.  pthread_cond_wait is also where
+    // we get canceled.
+    while(W->current_job == NULL)
+      pthread_cond_wait(&W->job_cond, &W->job_mutex);
+    thread_pool_job *J = W->current_job;
+
+    // the cleanup handler above unlocks a mutex we won't hold while
+    // the job runs, so don't let ourselves be canceled until we have
+    // it back
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
     pthread_mutex_unlock(&W->job_mutex);
 
-    // should we quit?
-    pthread_testcancel();
-
-    if(W->current_job == NULL)
-      continue;
+    // set up our context the first time we get a job
+    if(W->ctx == NULL && W->factory)
+      W->ctx = W->factory->create();
 
     // run the job
-    W->current_job->run();
+    J->run_with(W->ctx);
 
-    // lock for our condition variable (we'll do cond_wait on the next
-    // loop iteration); the rest of the stuff at the end of this
-    // iteration needs to be atomic, so we can ensure the controlling
-    // thread doesn't try to signal our condition variable until we're
-    // ready for it.
+    // the rest of the stuff at the end of this iteration needs to be
+    // atomic with respect to run_job(), so we can ensure the
+    // controlling thread doesn't hand us a new job until we're ready
+    // for it.
     pthread_mutex_lock(&W->job_mutex);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
 
     // put the job on the completed jobs queue
-    locker L(W->Q->mutex);
-    W->Q->push(thread_pool_cq_item(W->current_job, W));
-    W->current_job = NULL;
+    {
+      locker L(W->Q->mutex);
+      W->Q->push(thread_pool_cq_item(J, W));
+      W->current_job = NULL;
+    }
 
     // write to the thread pool's pipe to signal we've finished a job
     do {
@@ -354,6 +432,7 @@ void * thread_pool_worker_thread(void *arg)
 
   }
 
+  pthread_cleanup_pop(1);
   return NULL;
 }
 
@@ -375,6 +454,10 @@ thread_pool_worker::thread_pool_worker(const thread_pool_worker &W)
 thread_pool_worker::~thread_pool_worker()
 {
   cancel();
+
+  // our thread is gone, so its context can go too
+  if(ctx)
+    factory->destroy(ctx);
 }
 
 bool thread_pool_worker::run_job(thread_pool_job *job)
@@ -382,11 +465,14 @@ bool thread_pool_worker::run_job(thread_pool_job *job)
   if(current_job)
     return false;
 
+  // hand the job to our thread and signal it that it's got something
+  // to do
+  if(pthread_mutex_lock(&job_mutex) != 0)
+    return false;
+
   current_job = job;
 
-  // signal our thread that it's got something to do
-  if(pthread_mutex_lock(&job_mutex) != 0 ||
-     pthread_cond_signal(&job_cond) != 0 ||
+  if(pthread_cond_signal(&job_cond) != 0 ||
      pthread_mutex_unlock(&job_mutex) != 0)
   {
     return false;
@@ -399,6 +485,8 @@ void thread_pool_worker::init()
 {
   fd = -1;
   Q = NULL;
+  factory = NULL;
+  ctx = NULL;
   current_job = NULL;
 
   // set up the condition which will be signalled to tell our thread
@@ -0,0 +1,196 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A high-resolution clock based on the CPU's time stamp counter, for
+  timing things (request latencies, say) at nanosecond resolution
+  millions of times a second.  cached_time (cached_time.hpp) is cheap
+  but only as precise as its refresh interval, and clock_gettime() is
+  precise but costs tens of nanoseconds even through the vDSO.  Reading
+  the TSC costs a few dozen cycles (more under some hypervisors), and
+  converting it to nanoseconds is a multiply and a shift.
+
+  At startup the TSC is calibrated against CLOCK_MONOTONIC, and a
+  background thread recalibrates it periodically: it measures the TSC
+  frequency over the whole time the clock has been running, and
+  steers the conversion so that any error against CLOCK_MONOTONIC is
+  worked off over the next interval rather than jumping (unless the
+  clock has fallen more than an interval behind, when it jumps
+  forward).  The conversion parameters are published under a seqcount
+  (see seqlock.hpp), so reading the clock is lock-free.  now_ns()
+  returns nanoseconds on the CLOCK_MONOTONIC timescale.
+
+  The clock doesn't go backwards across a recalibration, either.
+  Readers read the TSC inside the seqcount's read section, and new
+  parameters are anchored at a TSC reading taken inside the write
+  section, where they agree with the old ones: every reading made
+  with the old parameters comes from before the anchor, and every
+  reading made with the new ones from after it.  (rdtsc isn't
+  serializing, so that's only true to within the few cycles the CPU
+  may run it early or late, which is well under a nanosecond of
+  difference between the two rates.)
+
+  The TSC is only used if the CPU says it's invariant (it ticks at a
+  constant rate regardless of frequency scaling and sleep states, and
+  is synchronized across cores) and calibration gives a sane answer.
+  Otherwise, or on anything but x86-64 (the conversion needs 128-bit
+  arithmetic), now_ns() falls back to clock_gettime(CLOCK_MONOTONIC);
+  check using_tsc() to find out which you got.  cycles_to_ns() still
+  converts with the startup calibration if there's a TSC that isn't
+  invariant, which is only an estimate; if there's no TSC at all,
+  cycles() is always 0 and so is the conversion.
+
+  This class can only be instantiated once.  To do so, call
+  tsc_clock::init(), which returns a reference to the instantiation.
+*/
+
+#ifndef _KRB_TSC_CLOCK_HPP
+#define _KRB_TSC_CLOCK_HPP
+
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <krb/seqlock.hpp>
+
+class tsc_clock
+{
+public:
+
+  // recalibrate every recalibrate_ms (0 means never).  the argument
+  // only matters the first time init() is called.  throws
+  // strerror_exception if the recalibration thread can't be started
+  // (and init() can be tried again later).
+  static tsc_clock & init(uint32_t recalibrate_ms = 1000)
+  {
+    static tsc_clock singleton(recalibrate_ms);
+    return singleton;
+  }
+
+  ~tsc_clock();
+
+  // raw time stamp counter (0 if there isn't one we can use)
+  static uint64_t cycles()
+  {
+#ifdef __x86_64__
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+  }
+
+  // nanoseconds on the CLOCK_MONOTONIC timescale
+  uint64_t now_ns() const
+  {
+    if(!tsc)
+      return monotonic_ns();
+
+    // the TSC has to be read inside the read section; see above
+    uint32_t s;
+    uint64_t c, base_cycles, base_ns, mult;
+    do {
+      s = conversion.read_begin();
+      base_cycles = load_relaxed(&current.base_cycles);
+      base_ns = load_relaxed(&current.base_ns);
+      mult = load_relaxed(&current.mult);
+      c = cycles();
+    } while(conversion.read_retry(s));
+
+    return base_ns + scale(c - base_cycles, mult);
+  }
+
+  void now(struct timespec *ts) const
+  {
+    uint64_t ns = now_ns();
+    ts->tv_sec = ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+  }
+
+  // convert a difference between two cycles() readings (an estimate
+  // if !using_tsc(); see above)
+  uint64_t cycles_to_ns(uint64_t c) const
+  {
+    return calibrated ? scale(c, load_relaxed(&current.mult)) : 0;
+  }
+
+  bool using_tsc() const { return tsc; }
+
+  // current estimate of the TSC frequency
+  double cycles_per_ns() const;
+
+  static uint64_t monotonic_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+protected:
+
+  tsc_clock(uint32_t recalibrate_ms); // private constructor
+  tsc_clock(const tsc_clock &);       // no copy construction
+  tsc_clock & operator=(const tsc_clock &); // no assignment
+
+  // ns = base_ns + (cycles - base_cycles) * mult >> shift
+  static const uint32_t shift = 32;
+
+  struct params
+  {
+    uint64_t base_cycles, base_ns, mult;
+  };
+
+#ifdef __x86_64__
+  static uint64_t scale(uint64_t c, uint64_t mult)
+  {
+    return (uint64_t)(((__uint128_t)c * mult) >> shift);
+  }
+#else
+  static uint64_t scale(uint64_t, uint64_t) { return 0; } // never used
+#endif
+
+  // read the TSC and CLOCK_MONOTONIC as close together as we can
+  static void sample(uint64_t &c, uint64_t &ns);
+
+  static bool invariant_tsc();
+  bool calibrate();
+  void recalibrate();
+
+  bool tsc, calibrated;
+  uint32_t interval_usec;
+  pthread_t tid;
+
+  // the first calibration sample, for measuring the frequency over a
+  // long baseline; only touched by the constructor and our thread
+  uint64_t first_cycles, first_ns;
+
+  seqcount conversion;
+  params current;
+
+  friend void * tsc_clock_processor(void *arg);
+
+};
+
+#endif // _KRB_TSC_CLOCK_HPP
@@ -0,0 +1,283 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  A reader-writer lock with an "upgradable" read mode.  Any number of
+  plain readers can share the lock with at most one upgradable reader,
+  which can later turn its lock into a write lock without ever letting
+  go of it.  With read_locker::upgrade_to_write() (locker.hpp), the
+  read lock is dropped before the write lock is taken, so another
+  writer can get in between and everything checked under the read lock
+  has to be checked again.  An upgradable reader can't be overtaken
+  that way, since writers and other upgradable readers are kept out
+  until it's done, so check-then-insert code only has to look once:
+
+    upgradable_rwlock L;
+
+    upgrade_locker U(L);
+    iterator i = table.find(key);
+    if(i == table.end()) {
+      U.upgrade();              // waits for plain readers to leave
+      table.insert(key, value); // no need to look again
+    }
+
+  Only one thread at a time can hold the upgradable lock, so use it for
+  paths that may write, and plain reads (ur_read_locker) everywhere
+  else.  Writers get preference over new readers, and an upgrade in
+  progress keeps new readers out while the existing ones drain.  The
+  lock is built from a pthread mutex and condition variables, so it's
+  no faster than a pthread_rwlock_t; its point is the upgrade.
+
+  Use ur_read_locker, ur_write_locker and upgrade_locker, which work
+  like the objects in locker.hpp.
+*/
+
+#ifndef _KRB_UPGRADE_LOCK_HPP
+#define _KRB_UPGRADE_LOCK_HPP
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <krb/exceptions.hpp>
+#include <krb/locker.hpp>
+
+class upgradable_rwlock
+{
+public:
+
+  upgradable_rwlock();
+  ~upgradable_rwlock();
+
+  void read_lock();
+  void read_unlock();
+
+  void write_lock();
+  void write_unlock();
+
+  // shares the lock with plain readers, but not with writers or
+  // another upgradable reader
+  void upgrade_lock();
+  void upgrade_unlock();
+
+  // trade an upgradable lock for a write lock, once plain readers have
+  // left, or a write lock for an upgradable one
+  void upgrade();
+  void downgrade();
+
+protected:
+
+  upgradable_rwlock(const upgradable_rwlock &);         // no copying
+  upgradable_rwlock & operator=(const upgradable_rwlock &);
+
+  pthread_mutex_t mutex;
+  pthread_cond_t gate;    // waiting for the lock to be available
+  pthread_cond_t drained; // upgrader waiting for readers to leave
+
+  uint32_t readers, writers_waiting;
+  bool writer, upgrader, upgrading;
+};
+
+
+class ur_read_locker
+{
+public:
+
+  ur_read_locker(upgradable_rwlock &lock)
+    : L(lock)
+  {
+    L.read_lock();
+  }
+
+  ~ur_read_locker()
+  {
+    L.read_unlock();
+  }
+
+protected:
+  upgradable_rwlock &L;
+
+};
+
+
+class ur_write_locker
+{
+public:
+
+  ur_write_locker(upgradable_rwlock &lock)
+    : L(lock)
+  {
+    L.write_lock();
+  }
+
+  ~ur_write_locker()
+  {
+    L.write_unlock();
+  }
+
+protected:
+  upgradable_rwlock &L;
+
+};
+
+
+class upgrade_locker
+{
+public:
+
+  upgrade_locker(upgradable_rwlock &lock)
+    : L(lock), writing(false)
+  {
+    L.upgrade_lock();
+  }
+
+  ~upgrade_locker()
+  {
+    if(writing)
+      L.write_unlock();
+    else
+      L.upgrade_unlock();
+  }
+
+  void upgrade()
+  {
+    if(!writing) {
+      L.upgrade();
+      writing = true;
+    }
+  }
+
+  void downgrade()
+  {
+    if(writing) {
+      L.downgrade();
+      writing = false;
+    }
+  }
+
+  bool is_writing() const { return writing; }
+
+protected:
+  upgradable_rwlock &L;
+  bool writing;
+
+};
+
+
+
+//////////////////////////////////////////////////////////////////////
+// implementation details
+//////////////////////////////////////////////////////////////////////
+
+inline upgradable_rwlock::upgradable_rwlock()
+  : readers(0), writers_waiting(0),
+    writer(false), upgrader(false), upgrading(false)
+{
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&gate, NULL);
+  pthread_cond_init(&drained, NULL);
+}
+
+inline upgradable_rwlock::~upgradable_rwlock()
+{
+  pthread_cond_destroy(&drained);
+  pthread_cond_destroy(&gate);
+  pthread_mutex_destroy(&mutex);
+}
+
+inline void upgradable_rwlock::read_lock()
+{
+  locker L(mutex);
+  while(writer || writers_waiting > 0 || upgrading)
+    pthread_cond_wait(&gate, &mutex);
+  ++readers;
+}
+
+inline void upgradable_rwlock::read_unlock()
+{
+  locker L(mutex);
+  if(--readers == 0) {
+    if(upgrading)
+      pthread_cond_signal(&drained);
+    else if(writers_waiting > 0)
+      pthread_cond_broadcast(&gate);
+  }
+}
+
+inline void upgradable_rwlock::write_lock()
+{
+  locker L(mutex);
+  ++writers_waiting;
+  while(writer || upgrader || readers > 0)
+    pthread_cond_wait(&gate, &mutex);
+  --writers_waiting;
+  writer = true;
+}
+
+inline void upgradable_rwlock::write_unlock()
+{
+  locker L(mutex);
+  writer = false;
+  pthread_cond_broadcast(&gate);
+}
+
+inline void upgradable_rwlock::upgrade_lock()
+{
+  locker L(mutex);
+  while(writer || upgrader || writers_waiting > 0)
+    pthread_cond_wait(&gate, &mutex);
+  upgrader = true;
+}
+
+inline void upgradable_rwlock::upgrade_unlock()
+{
+  locker L(mutex);
+  upgrader = false;
+  pthread_cond_broadcast(&gate);
+}
+
+inline void upgradable_rwlock::upgrade()
+{
+  locker L(mutex);
+
+  // nobody but plain readers can be in here with us, and no new ones
+  // get in while we wait for them to leave
+  upgrading = true;
+  while(readers > 0)
+    pthread_cond_wait(&drained, &mutex);
+  upgrading = false;
+  upgrader = false;
+  writer = true;
+}
+
+inline void upgradable_rwlock::downgrade()
+{
+  locker L(mutex);
+  writer = false;
+  upgrader = true;
+
+  // readers can come back in
+  pthread_cond_broadcast(&gate);
+}
+
+#endif // _KRB_UPGRADE_LOCK_HPP
@@ -31,6 +31,9 @@
   "interval resolution" --- every interval gets its own Bloom filter,
   and we keep enough intervals to cover the desired working set
   period.
+
+  The optional Alloc template argument is used (rebound) for the list
+  of intervals.
  */
 
 #ifndef _KRB_WSS_ESTIMATOR_HPP
@@ -38,8 +41,10 @@
 
 #include <krb/bloom_filter.hpp>
 #include <list>
+#include <memory>
 
-template <class size_type = uint64_t>
+template <class size_type = uint64_t,
+          class Alloc = std::allocator<size_type> >
 class wss_estimator
 {
 
@@ -108,7 +113,9 @@ public:
 protected:
 
   typedef std::pair<bloom_filter, size_type> interval_t;
-  typedef std::list<interval_t> interval_list;
+  typedef std::list
+    <interval_t, typename Alloc::template rebind<interval_t>::other>
+      interval_list;
   typedef typename interval_list::const_iterator interval_iterator;
 
   interval_list filters;
@@ -123,8 +130,8 @@ protected:
 // implementation details
 //////////////////////////////////////////////////////////////////////
 
-template <class size_type>
-wss_estimator<size_type>::wss_estimator
+template <class size_type, class Alloc>
+wss_estimator<size_type, Alloc>::wss_estimator
   (uint32_t num_intervals,
    uint32_t elements_per_interval,
    double false_pos_rate,
@@ -137,8 +144,8 @@ wss_estimator<size_type>::wss_estimator
   filters.push_front(interval_t(bloom_filter(E, fp_rate), 0));
 }
 
-template <class size_type>
-void wss_estimator<size_type>::add
+template <class size_type, class Alloc>
+void wss_estimator<size_type, Alloc>::add
   (const void *key, uint32_t sz, uint32_t bytes)
 {
   // first check if this key is already in the working set by querying
@@ -153,8 +160,8 @@ void wss_estimator<size_type>::add
   ++cur_set_size;
 }
 
-template <class size_type>
-void wss_estimator<size_type>::end_interval()
+template <class size_type, class Alloc>
+void wss_estimator<size_type, Alloc>::end_interval()
 {
   uint32_t next_E = E;
 
@@ -178,8 +185,8 @@ void wss_estimator<size_type>::end_interval()
   cur_set_size = 0;
 }
 
-template <class size_type>
-size_type wss_estimator<size_type>::size() const
+template <class size_type, class Alloc>
+size_type wss_estimator<size_type, Alloc>::size() const
 {
   size_type S = 0;
   for(interval_iterator i = filters.begin(); i != filters.end(); ++i)
@@ -196,8 +203,8 @@ size_type wss_estimator<size_type>::size() const
 // completed enough intervals to cover a full working set period.
 // then we just project our current data forward to to estimate the
 // missing data before adding fp_rate*SIZE.
-template <class size_type>
-size_type wss_estimator<size_type>::best_guess
+template <class size_type, class Alloc>
+size_type wss_estimator<size_type, Alloc>::best_guess
   (double interval_percent) const
 {
   size_type S = 0;
@@ -234,8 +241,8 @@ size_type wss_estimator<size_type>::best_guess
 
 }
 
-template <class size_type>
-uint32_t wss_estimator<size_type>::buckets() const
+template <class size_type, class Alloc>
+uint32_t wss_estimator<size_type, Alloc>::buckets() const
 {
   uint32_t B = 0;
   for(interval_iterator i = filters.begin(); i != filters.end(); ++i)
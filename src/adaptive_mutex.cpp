@@ -0,0 +1,198 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <krb/adaptive_mutex.hpp>
+#include <krb/locker.hpp>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+
+// registry of named mutexes
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static std::vector<adaptive_mutex *> & registry()
+{
+  static std::vector<adaptive_mutex *> *R = new std::vector<adaptive_mutex *>;
+  return *R;
+}
+
+static bool multiprocessor()
+{
+  static long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 1;
+}
+
+void lock_histogram::clear()
+{
+  for(uint32_t i = 0; i < n_buckets; ++i)
+    buckets[i] = 0;
+}
+
+void lock_histogram::add(uint64_t ns)
+{
+  uint32_t b = ns ? 63 - __builtin_clzll(ns) : 0;
+  ++buckets[b < n_buckets ? b : n_buckets - 1];
+}
+
+uint64_t lock_histogram::count() const
+{
+  uint64_t n = 0;
+  for(uint32_t i = 0; i < n_buckets; ++i)
+    n += buckets[i];
+  return n;
+}
+
+uint64_t lock_histogram::percentile(double p) const
+{
+  uint64_t n = count();
+  if(n == 0)
+    return 0;
+
+  uint64_t want = (uint64_t)(p * n), seen = 0;
+  if(want >= n)
+    want = n - 1;
+  for(uint32_t i = 0; i < n_buckets; ++i) {
+    seen += buckets[i];
+    if(seen > want)
+      return ((uint64_t)2 << i) - 1;
+  }
+  return ((uint64_t)2 << (n_buckets - 1)) - 1;
+}
+
+adaptive_mutex::adaptive_mutex(const char *name, uint32_t spin)
+  : state(0), spin_limit(spin), stats(NULL), hold_start(0)
+{
+  if(name) {
+    lock_name = name;
+    stats = new lock_stats;
+    locker L(registry_mutex);
+    registry().push_back(this);
+  }
+}
+
+adaptive_mutex::~adaptive_mutex()
+{
+  if(stats) {
+    {
+      locker L(registry_mutex);
+      std::vector<adaptive_mutex *> &R = registry();
+      R.erase(std::remove(R.begin(), R.end(), this), R.end());
+    }
+    delete stats;
+  }
+}
+
+void adaptive_mutex::lock_contended()
+{
+  uint64_t wait_start = stats ? now_ns() : 0;
+
+  // spin with exponential backoff, as long as nobody's asleep (if
+  // they are, they'd get the lock before us anyway)
+  if(multiprocessor()) {
+    uint32_t delay = 1;
+    for(uint32_t spun = 0; spun < spin_limit; spun += delay) {
+      for(uint32_t i = 0; i < delay; ++i)
+        cpu_relax();
+      if(delay < 64)
+        delay <<= 1;
+
+      uint32_t s = load_relaxed(&state);
+      if(s == 2)
+        break;
+      if(s == 0 && __sync_bool_compare_and_swap(&state, 0, 1)) {
+        if(stats)
+          acquired(wait_start, true);
+        return;
+      }
+    }
+  }
+
+  // sleep until we get it.  we mark the lock as possibly having
+  // sleepers (2) whenever we take it from here, since we can't tell
+  // whether anybody else is still asleep.
+  uint32_t s = __sync_lock_test_and_set(&state, 2);
+  while(s != 0) {
+    futex_wait(&state, 2);
+    s = __sync_lock_test_and_set(&state, 2);
+  }
+
+  if(stats)
+    acquired(wait_start, true);
+}
+
+void adaptive_mutex::acquired(uint64_t wait_start, bool contended)
+{
+  hold_start = now_ns();
+  ++stats->acquisitions;
+  if(contended) {
+    ++stats->contended;
+    stats->wait_ns.add(hold_start - wait_start);
+  } else
+    stats->wait_ns.add(0);
+}
+
+void adaptive_mutex::releasing()
+{
+  stats->hold_ns.add(now_ns() - hold_start);
+}
+
+lock_stats adaptive_mutex::get_stats() const
+{
+  return stats ? *stats : lock_stats();
+}
+
+void adaptive_mutex::reset_stats()
+{
+  if(stats) {
+    adaptive_locker L(*this);
+    *stats = lock_stats();
+  }
+}
+
+void adaptive_mutex::dump_stats(FILE *out)
+{
+  locker L(registry_mutex);
+  std::vector<adaptive_mutex *> &R = registry();
+
+  fprintf(out, "%-24s %12s %12s %7s %10s %10s %10s %10s %10s\n",
+          "lock", "acquired", "contended", "pct", "wait p50", "wait p99",
+          "hold p50", "hold p99", "hold max");
+
+  for(uint32_t i = 0; i < R.size(); ++i) {
+    lock_stats S = R[i]->get_stats();
+    fprintf(out, "%-24s %12llu %12llu %6.2f%% %8lluns %8lluns "
+            "%8lluns %8lluns %8lluns\n",
+            R[i]->name().c_str(),
+            (unsigned long long)S.acquisitions,
+            (unsigned long long)S.contended,
+            S.acquisitions ? 100.0 * S.contended / S.acquisitions : 0.0,
+            (unsigned long long)S.wait_ns.percentile(0.5),
+            (unsigned long long)S.wait_ns.percentile(0.99),
+            (unsigned long long)S.hold_ns.percentile(0.5),
+            (unsigned long long)S.hold_ns.percentile(0.99),
+            (unsigned long long)S.hold_ns.percentile(1.0));
+  }
+}
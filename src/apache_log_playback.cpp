@@ -30,10 +30,25 @@ apache_log_playback::apache_log_playback
    uint32_t buffered_entries, double speed)
     : is(input), cb(callback),
       buf_size(buffered_entries), speed_mult(speed),
+      buffer(new multimap_buffer< std::allocator<apache_log_entry> >),
       line_no(0), last_entry_time(0), delay_usec(0)
 {
 }
 
+apache_log_playback::apache_log_playback
+  (std::istream &input, apache_log_callback &callback,
+   uint32_t buffered_entries, double speed, entry_buffer *buf)
+    : is(input), cb(callback),
+      buf_size(buffered_entries), speed_mult(speed), buffer(buf),
+      line_no(0), last_entry_time(0), delay_usec(0)
+{
+}
+
+apache_log_playback::~apache_log_playback()
+{
+  delete buffer;
+}
+
 bool apache_log_playback::single_entry()
 {
   apache_log_entry e;
@@ -53,16 +68,15 @@ bool apache_log_playback::single_entry()
     if(buf_size > 0) {
       // add the entry to the buffer if we got a new one
       if(read_entry)
-        buffer.insert(buf_inserter(e.time(), e));
+        buffer->insert(e);
 
       // if the buffer is full, pop an entry off for processing; do
       // the same if nothing was read so we drain the buffer; and if
       // the buffer isn't full and we read an entry, keep reading
-      if(buffer.size() >= buf_size || !read_entry) {
-        e = buffer.begin()->second;
-        buffer.erase(buffer.begin());
+      if(buffer->size() >= buf_size || !read_entry) {
+        buffer->pop(e);
         keep_reading = false;
-      } else if(buffer.size() < buf_size && read_entry)
+      } else if(buffer->size() < buf_size && read_entry)
         keep_reading = true;
 
     }
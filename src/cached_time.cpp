@@ -24,6 +24,7 @@
 */
 
 #include <krb/cached_time.hpp>
+#include <krb/exceptions.hpp>
 #include <unistd.h>
 
 // thread entry point
@@ -31,81 +32,78 @@ void * cached_time_processor(void *arg)
 {
   cached_time *C = (cached_time *)arg;
 
-  // allow ourselves to be canceled
+  // allow ourselves to be canceled, but not in the middle of a
+  // refresh, which would leave readers spinning
   int old_cancel_state;
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
 
   while(1) {
-    pthread_testcancel();
-
-    // wait for the timeout
+    // wait for the timeout (a cancellation point)
     usleep(C->interval_usec);
 
-    // mark cached data stale; now the next time either time() or
-    // gettimeofday() is called, it'll refresh the data then cause us
-    // to loop again.
-    C->stale_time = true;
-    C->stale_gettimeofday = true;
-
-    // wait for one of time() or gettimeofday() to be called before
-    // looping again.
-    pthread_mutex_lock(&C->renew_mutex);
-    pthread_cond_wait(&C->renew_cond, &C->renew_mutex);
-    pthread_mutex_unlock(&C->renew_mutex);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
+    C->refresh();
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
   }
+
+  return NULL;
+}
+
+// use the coarse clock if the kernel has it
+static clockid_t pick_clock(clockid_t precise, clockid_t coarse)
+{
+  struct timespec ts;
+  return clock_getres(coarse, &ts) == 0 ? coarse : precise;
 }
 
-cached_time::cached_time(uint32_t interval_ms)
-  : interval_usec(interval_ms * 1000),
-    stale_time(true), stale_gettimeofday(true)
+cached_time::cached_time(uint32_t interval_ms, clock_source source)
+  : interval_usec(interval_ms * 1000), src(source),
+    real_clock(CLOCK_REALTIME), mono_clock(CLOCK_MONOTONIC)
 {
-  // set up the condition which will be signaled to tell our thread it
-  // needs to stale-ify our cached values after the timeout
-  pthread_mutex_init(&renew_mutex, 0);
-  pthread_cond_init(&renew_cond, 0);
+#if defined(CLOCK_REALTIME_COARSE) && defined(CLOCK_MONOTONIC_COARSE)
+  if(src == coarse_clock) {
+    real_clock = pick_clock(CLOCK_REALTIME, CLOCK_REALTIME_COARSE);
+    mono_clock = pick_clock(CLOCK_MONOTONIC, CLOCK_MONOTONIC_COARSE);
+  }
+#endif
+  if(real_clock == CLOCK_REALTIME)
+    src = precise_clock;
+
+  // there's a valid snapshot before anybody can read one
+  refresh();
 
   // set up the time worker thread
   pthread_attr_t attr;
   pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
   // allocate a minimal stack as we hardly use the stack in this
   // thread; this is PTHREAD_STACK_MIN (16384 on most systems) + 512
   pthread_attr_setstacksize(&attr, 16896);
 
-  // start the thread
-  pthread_create(&tid, &attr, cached_time_processor, this);
-
+  // start the thread; without it the time would never change, so
+  // there's no point carrying on
+  int rv = pthread_create(&tid, &attr, cached_time_processor, this);
   pthread_attr_destroy(&attr);
+  if(rv != 0)
+    throw strerror_exception("Creating time cache thread", rv);
 }
 
 cached_time::~cached_time()
 {
-  if(tid) {
-    pthread_cancel(tid);
-    pthread_cond_broadcast(&renew_cond);
-  }
-}
-
-time_t cached_time::time()
-{
-  if(stale_time) {
-    c_time = ::time(NULL);
-    stale_time = false;
-    pthread_cond_broadcast(&renew_cond);
-  }
-
-  return c_time;
+  // wait for it to go, so it can't refresh a snapshot that's being
+  // destroyed
+  pthread_cancel(tid);
+  pthread_join(tid, NULL);
 }
 
-int cached_time::gettimeofday(struct timeval *tv)
+void cached_time::refresh()
 {
-  if(stale_gettimeofday) {
-    c_gettimeofday_rv = ::gettimeofday(&c_gettimeofday, NULL);
-    stale_gettimeofday = false;
-    pthread_cond_broadcast(&renew_cond);
-  }
-
-  tv = &c_gettimeofday;
-  return c_gettimeofday_rv;
+  times T;
+  clock_gettime(real_clock, &T.real);
+  clock_gettime(mono_clock, &T.mono);
+  T.tv.tv_sec = T.real.tv_sec;
+  T.tv.tv_usec = T.real.tv_nsec / 1000;
+  T.t = T.real.tv_sec;
+
+  snapshot.store(T);
 }
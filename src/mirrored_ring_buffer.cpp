@@ -0,0 +1,171 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <krb/mirrored_ring_buffer.hpp>
+#include <krb/exceptions.hpp>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// get an anonymous shared memory file descriptor, or -1
+static int anonymous_shm_fd()
+{
+#ifdef SYS_memfd_create
+  int fd = syscall(SYS_memfd_create, "mirrored_ring_buffer", 0);
+  if(fd >= 0 || errno != ENOSYS)
+    return fd;
+#endif
+
+  // no memfd_create; fall back to a file in /dev/shm
+  char path[] = "/dev/shm/mirrored_ring_buffer.XXXXXX";
+  int fd2 = mkstemp(path);
+  if(fd2 >= 0)
+    unlink(path);
+  return fd2;
+}
+
+mirrored_ring_buffer::mirrored_ring_buffer(uint32_t size)
+  : buf(NULL), start(0), count(0)
+{
+  const uint32_t page = sysconf(_SC_PAGESIZE);
+  buf_sz = size < page ? page : (size + page - 1) / page * page;
+
+  int fd = anonymous_shm_fd();
+  if(fd < 0)
+    throw strerror_exception("Creating ring buffer memory", errno);
+
+  if(ftruncate(fd, buf_sz) < 0) {
+    int e = errno;
+    close(fd);
+    throw strerror_exception("Sizing ring buffer memory", e);
+  }
+
+  // reserve enough address space for both copies, then map the file
+  // over each half
+  void *base = mmap(NULL, 2 * (size_t)buf_sz, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(base == MAP_FAILED) {
+    int e = errno;
+    close(fd);
+    throw strerror_exception("Reserving ring buffer address space", e);
+  }
+
+  char *b = (char *)base;
+  if(mmap(b, buf_sz, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+     mmap(b + buf_sz, buf_sz, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+  {
+    int e = errno;
+    munmap(base, 2 * (size_t)buf_sz);
+    close(fd);
+    throw strerror_exception("Mapping ring buffer memory", e);
+  }
+
+  // the mappings keep the memory around
+  close(fd);
+  buf = b;
+}
+
+mirrored_ring_buffer::~mirrored_ring_buffer()
+{
+  munmap(buf, 2 * (size_t)buf_sz);
+}
+
+bool mirrored_ring_buffer::read_advance(uint32_t n)
+{
+  if(n > count)
+    return false;
+
+  start += n;
+  if(start >= buf_sz)
+    start -= buf_sz;
+  count -= n;
+
+  return true;
+}
+
+bool mirrored_ring_buffer::read(char *out, uint32_t n)
+{
+  if(n > count)
+    return false;
+
+  memcpy(out, buf + start, n);
+  return read_advance(n);
+}
+
+bool mirrored_ring_buffer::write_advance(uint32_t n)
+{
+  if(n > available())
+    return false;
+
+  count += n;
+  return true;
+}
+
+bool mirrored_ring_buffer::write(const char *in, uint32_t n)
+{
+  if(n > available())
+    return false;
+
+  memcpy(buf + end(), in, n);
+  return write_advance(n);
+}
+
+ssize_t mirrored_ring_buffer::read_from_fd(int fd, uint32_t max)
+{
+  uint32_t n = available() < max ? available() : max;
+  if(n == 0) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  ssize_t rv;
+  do {
+    rv = ::read(fd, buf + end(), n);
+  } while(rv < 0 && errno == EINTR);
+
+  if(rv > 0)
+    write_advance(rv);
+  return rv;
+}
+
+ssize_t mirrored_ring_buffer::write_to_fd(int fd, uint32_t max)
+{
+  uint32_t n = count < max ? count : max;
+  if(n == 0)
+    return 0;
+
+  ssize_t rv;
+  do {
+    rv = ::write(fd, buf + start, n);
+  } while(rv < 0 && errno == EINTR);
+
+  if(rv > 0)
+    read_advance(rv);
+  return rv;
+}
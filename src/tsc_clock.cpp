@@ -0,0 +1,193 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <krb/tsc_clock.hpp>
+#include <krb/exceptions.hpp>
+#include <unistd.h>
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+
+// thread entry point
+void * tsc_clock_processor(void *arg)
+{
+  tsc_clock *C = (tsc_clock *)arg;
+
+  // allow ourselves to be canceled, but not in the middle of
+  // publishing new parameters, which would leave readers spinning
+  int old_cancel_state;
+  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
+
+  while(1) {
+    // wait for the timeout (a cancellation point)
+    usleep(C->interval_usec);
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancel_state);
+    C->recalibrate();
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancel_state);
+  }
+
+  return NULL;
+}
+
+tsc_clock::tsc_clock(uint32_t recalibrate_ms)
+  : tsc(false), calibrated(false), interval_usec(recalibrate_ms * 1000),
+    tid(0), first_cycles(0), first_ns(0)
+{
+  // calibrate even a TSC we won't use, for cycles_to_ns()
+  calibrated = calibrate();
+  tsc = calibrated && invariant_tsc();
+  if(!tsc || interval_usec == 0)
+    return;
+
+  // set up the recalibration thread
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+
+  // allocate a minimal stack as we hardly use the stack in this
+  // thread; this is PTHREAD_STACK_MIN (16384 on most systems) + 512
+  pthread_attr_setstacksize(&attr, 16896);
+
+  int rv = pthread_create(&tid, &attr, tsc_clock_processor, this);
+  pthread_attr_destroy(&attr);
+  if(rv != 0)
+    throw strerror_exception("Creating TSC recalibration thread", rv);
+}
+
+tsc_clock::~tsc_clock()
+{
+  if(tid) {
+    pthread_cancel(tid);
+    pthread_join(tid, NULL);
+  }
+}
+
+double tsc_clock::cycles_per_ns() const
+{
+  if(!calibrated)
+    return 0;
+  return (double)((uint64_t)1 << shift) / load_relaxed(&current.mult);
+}
+
+bool tsc_clock::invariant_tsc()
+{
+#ifdef __x86_64__
+  // CPUID 0x80000007, EDX bit 8: invariant TSC
+  unsigned int eax, ebx, ecx, edx;
+  if(!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+    return false;
+  if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return false;
+  return (edx & (1 << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+void tsc_clock::sample(uint64_t &c, uint64_t &ns)
+{
+  // keep the tightest of a few tries, in case we got interrupted
+  uint64_t best = ~(uint64_t)0;
+  for(uint32_t i = 0; i < 5; ++i) {
+    uint64_t before = cycles();
+    uint64_t t = monotonic_ns();
+    uint64_t after = cycles();
+    if(after - before < best) {
+      best = after - before;
+      c = before + best / 2;
+      ns = t;
+    }
+  }
+}
+
+bool tsc_clock::calibrate()
+{
+#ifdef __x86_64__
+  sample(first_cycles, first_ns);
+  usleep(10000);
+  uint64_t c, ns;
+  sample(c, ns);
+
+  // anything outside 100MHz-10GHz means the TSC isn't what we think
+  uint64_t dc = c - first_cycles, dns = ns - first_ns;
+  if(c <= first_cycles || dns == 0 || dc < dns / 10 || dc > dns * 10)
+    return false;
+
+  seq_write_locker W(conversion);
+  store_relaxed(&current.base_cycles, c);
+  store_relaxed(&current.base_ns, ns);
+  store_relaxed(&current.mult,
+                (uint64_t)(((__uint128_t)dns << shift) / dc));
+  return true;
+#else
+  return false;
+#endif
+}
+
+void tsc_clock::recalibrate()
+{
+#ifdef __x86_64__
+  uint64_t c, ns;
+  sample(c, ns);
+
+  // we're the only writer, so we can read the parameters directly
+  params old;
+  old.base_cycles = load_relaxed(&current.base_cycles);
+  old.base_ns = load_relaxed(&current.base_ns);
+  old.mult = load_relaxed(&current.mult);
+  if(c <= old.base_cycles)
+    return;
+
+  // the frequency over the whole time we've been running, and where
+  // the current parameters say we are
+  uint64_t mult = ((__uint128_t)(ns - first_ns) << shift) / (c - first_cycles);
+  uint64_t computed = old.base_ns + scale(c - old.base_cycles, old.mult);
+  int64_t err = (int64_t)(ns - computed);
+  int64_t interval_ns = (int64_t)interval_usec * 1000;
+
+  uint64_t jump = 0;
+  if(err > interval_ns) {
+    // way behind; jump ahead rather than running fast for ages
+    jump = err;
+  } else {
+    // steer so we're back on CLOCK_MONOTONIC after one more interval,
+    // without running at less than half speed
+    if(err < -interval_ns / 2)
+      err = -interval_ns / 2;
+    uint64_t interval_cycles = ((__uint128_t)interval_ns << shift) / mult;
+    mult = ((__uint128_t)(interval_ns + err) << shift) / interval_cycles;
+  }
+
+  // anchor the new parameters where the old ones say we are now,
+  // with readers locked out (see tsc_clock.hpp)
+  seq_write_locker W(conversion);
+  uint64_t anchor = cycles();
+  store_relaxed(&current.base_ns,
+                old.base_ns + scale(anchor - old.base_cycles, old.mult) +
+                jump);
+  store_relaxed(&current.base_cycles, anchor);
+  store_relaxed(&current.mult, mult);
+#endif
+}
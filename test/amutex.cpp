@@ -0,0 +1,155 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Contention benchmark for adaptive_mutex against pthread_mutex_t (via
+  locker).  For 1 to N threads (doubling), each thread repeatedly
+  takes the lock, bumps a couple of shared counters, and lets go; at
+  the end the counters are checked.  Output is CSV on stdout:
+
+    lock,threads,acquisitions,seconds,acquisitions_per_sec
+
+  Then a named (profiled) adaptive_mutex is run with N threads and its
+  statistics are dumped to stderr.
+
+  $ ./amutex [max threads] [acquisitions per thread] > amutex.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/adaptive_mutex.hpp>
+#include <krb/locker.hpp>
+
+struct shared_data
+{
+  uint64_t a, b;
+};
+
+struct pthread_policy
+{
+  pthread_mutex_t M;
+  pthread_policy(const char *) { pthread_mutex_init(&M, NULL); }
+  ~pthread_policy() { pthread_mutex_destroy(&M); }
+  typedef locker guard;
+  pthread_mutex_t & lock() { return M; }
+};
+
+struct adaptive_policy
+{
+  adaptive_mutex M;
+  adaptive_policy(const char *name) : M(name) {}
+  typedef adaptive_locker guard;
+  adaptive_mutex & lock() { return M; }
+};
+
+template <class Policy>
+struct bench_args
+{
+  Policy *P;
+  shared_data *data;
+  uint32_t n;
+};
+
+template <class Policy>
+void * worker(void *arg)
+{
+  bench_args<Policy> *A = (bench_args<Policy> *)arg;
+  for(uint32_t i = 0; i < A->n; ++i) {
+    typename Policy::guard G(A->P->lock());
+    ++A->data->a;
+    A->data->b += 2;
+  }
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Policy>
+void run(const char *label, Policy &P, uint32_t threads, uint32_t n)
+{
+  shared_data data = { 0, 0 };
+  bench_args<Policy> A = { &P, &data, n };
+  std::vector<pthread_t> tids(threads);
+
+  double start = now();
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_create(&tids[t], NULL, worker<Policy>, &A);
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+  double elapsed = now() - start;
+
+  uint64_t total = (uint64_t)threads * n;
+  if(data.a != total || data.b != 2 * total) {
+    fprintf(stderr, "%s: lost updates with %u threads (%llu of %llu)\n",
+            label, threads, (unsigned long long)data.a,
+            (unsigned long long)total);
+    exit(1);
+  }
+
+  printf("%s,%u,%llu,%.3f,%.0f\n", label, threads,
+         (unsigned long long)total, elapsed, total / elapsed);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_threads = argc > 1 ? atoi(argv[1]) : 8;
+  uint32_t n = argc > 2 ? atoi(argv[2]) : 1000000;
+
+  printf("lock,threads,acquisitions,seconds,acquisitions_per_sec\n");
+  for(uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+    {
+      pthread_policy P(NULL);
+      run("pthread", P, threads, n);
+    }
+    {
+      adaptive_policy P(NULL);
+      run("adaptive", P, threads, n);
+    }
+  }
+
+  adaptive_policy P("amutex.profiled");
+  run("profiled", P, max_threads, n);
+
+  lock_stats S = P.M.get_stats();
+  if(S.acquisitions != (uint64_t)max_threads * n ||
+     S.wait_ns.count() != S.acquisitions ||
+     S.hold_ns.count() != S.acquisitions)
+  {
+    fprintf(stderr, "profiled: bad statistics\n");
+    return 1;
+  }
+
+  adaptive_mutex::dump_stats(stderr);
+  return 0;
+}
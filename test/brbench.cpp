@@ -0,0 +1,166 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Read-side scaling benchmark for brlock against pthread_rwlock_t (via
+  read_locker/write_locker).  For 1 to N reader threads (doubling),
+  each reader repeatedly takes the read lock and checks a small shared
+  structure for consistency, while one writer thread updates the
+  structure every millisecond.  Output is CSV on stdout:
+
+    lock,readers,reads,writes,seconds,reads_per_sec
+
+  $ ./brbench [max readers] [reads per thread] > brlock.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/brlock.hpp>
+#include <krb/locker.hpp>
+
+struct shared_data
+{
+  volatile uint64_t a, b;
+};
+
+struct rwlock_policy
+{
+  pthread_rwlock_t L;
+  rwlock_policy() { pthread_rwlock_init(&L, NULL); }
+  ~rwlock_policy() { pthread_rwlock_destroy(&L); }
+  typedef read_locker reader;
+  typedef write_locker writer;
+  pthread_rwlock_t & lock() { return L; }
+};
+
+struct brlock_policy
+{
+  brlock L;
+  typedef br_read_locker reader;
+  typedef br_write_locker writer;
+  brlock & lock() { return L; }
+};
+
+template <class Lock>
+struct bench_args
+{
+  Lock *lock;
+  shared_data *data;
+  uint32_t reads;
+  volatile bool *done;
+  uint32_t writes;
+};
+
+template <class Lock>
+void * reader_thread(void *arg)
+{
+  bench_args<Lock> *A = (bench_args<Lock> *)arg;
+
+  for(uint32_t i = 0; i < A->reads; ++i) {
+    typename Lock::reader R(A->lock->lock());
+    if(A->data->a != A->data->b) {
+      fprintf(stderr, "reader saw a torn update\n");
+      exit(1);
+    }
+  }
+
+  return NULL;
+}
+
+template <class Lock>
+void * writer_thread(void *arg)
+{
+  bench_args<Lock> *A = (bench_args<Lock> *)arg;
+
+  while(!*A->done) {
+    {
+      typename Lock::writer W(A->lock->lock());
+      A->data->a = A->data->a + 1;
+      A->data->b = A->data->a;
+    }
+    ++A->writes;
+    usleep(1000);
+  }
+
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Lock>
+void bench(const char *name, uint32_t readers, uint32_t reads)
+{
+  Lock lock;
+  shared_data data = { 0, 0 };
+  volatile bool done = false;
+  bench_args<Lock> A = { &lock, &data, reads, &done, 0 };
+  std::vector<pthread_t> tids(readers);
+  pthread_t wtid;
+
+  pthread_create(&wtid, NULL, writer_thread<Lock>, &A);
+
+  double start = now();
+  for(uint32_t t = 0; t < readers; ++t)
+    pthread_create(&tids[t], NULL, reader_thread<Lock>, &A);
+  for(uint32_t t = 0; t < readers; ++t)
+    pthread_join(tids[t], NULL);
+  double secs = now() - start;
+
+  done = true;
+  pthread_join(wtid, NULL);
+
+  uint64_t total = (uint64_t)readers * reads;
+  printf("%s,%u,%llu,%u,%.6f,%.1f\n", name, readers,
+         (unsigned long long)total, A.writes, secs, total / secs);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_readers = (argc > 1) ? atoi(argv[1]) : 8;
+  uint32_t reads = (argc > 2) ? atoi(argv[2]) : 2000000;
+
+  if(max_readers == 0 || reads == 0) {
+    fprintf(stderr, "Usage: %s [max readers] [reads per thread]\n", argv[0]);
+    return 1;
+  }
+
+  printf("lock,readers,reads,writes,seconds,reads_per_sec\n");
+  for(uint32_t r = 1; r <= max_readers; r *= 2) {
+    bench<rwlock_policy>("pthread_rwlock", r, reads);
+    bench<brlock_policy>("brlock", r, reads);
+  }
+
+  return 0;
+}
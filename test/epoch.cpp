@@ -0,0 +1,176 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Stress test for epoch_domain.  Reader threads repeatedly enter a
+  critical section, follow a shared pointer and check that the node it
+  points at hasn't been freed (freed nodes are poisoned first), while
+  writer threads keep swapping in new nodes and retiring the old ones.
+  At the end every retired node must have been freed exactly once.
+  Also reports the cost of an empty critical section.
+
+  $ ./epoch [readers] [writers] [swaps per writer]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/epoch.hpp>
+
+static const uint64_t live_magic = 0x6c6976656e6f6465ULL;
+static const uint64_t dead_magic = 0xdeadbeefdeadbeefULL;
+
+struct node
+{
+  volatile uint64_t magic;
+  uint64_t a, b;
+};
+
+static epoch_domain *domain;
+static node * volatile shared;
+static volatile uint32_t writers_running;
+static volatile uint64_t n_retired, n_freed;
+
+static void free_node(void *p)
+{
+  node *n = (node *)p;
+  if(n->magic != live_magic) {
+    fprintf(stderr, "node freed twice\n");
+    exit(1);
+  }
+  n->magic = dead_magic;
+  __sync_fetch_and_add(&n_freed, 1);
+  delete n;
+}
+
+void * reader(void *arg)
+{
+  uint64_t *reads = (uint64_t *)arg;
+  epoch_domain::participant *me = domain->register_thread();
+
+  while(load_acquire(&writers_running)) {
+    epoch_guard G(*domain, me);
+    node *n = load_acquire(&shared);
+    if(n->magic != live_magic || n->b != 2 * n->a) {
+      fprintf(stderr, "reader saw a freed node\n");
+      exit(1);
+    }
+    ++*reads;
+  }
+
+  domain->unregister_thread(me);
+  return NULL;
+}
+
+void * writer(void *arg)
+{
+  uint32_t swaps = *(uint32_t *)arg;
+  epoch_domain::participant *me = domain->register_thread();
+
+  for(uint32_t i = 0; i < swaps; ++i) {
+    node *n = new node;
+    n->magic = live_magic;
+    n->a = i;
+    n->b = 2 * i;
+
+    epoch_guard G(*domain, me);
+    node *old;
+    do {
+      old = load_acquire(&shared);
+    } while(!__sync_bool_compare_and_swap(&shared, old, n));
+    domain->retire(me, old, free_node);
+    __sync_fetch_and_add(&n_retired, 1);
+  }
+
+  domain->unregister_thread(me);
+  __sync_fetch_and_sub(&writers_running, 1);
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t readers = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t writers = argc > 2 ? atoi(argv[2]) : 2;
+  uint32_t swaps = argc > 3 ? atoi(argv[3]) : 200000;
+
+  domain = new epoch_domain;
+
+  // cost of an empty critical section
+  {
+    epoch_domain::participant *me = domain->register_thread();
+    const uint32_t n = 10000000;
+    double start = now();
+    for(uint32_t i = 0; i < n; ++i) {
+      epoch_guard G(*domain, me);
+    }
+    printf("enter/exit: %.1f ns\n", (now() - start) / n * 1e9);
+    domain->unregister_thread(me);
+  }
+
+  shared = new node;
+  shared->magic = live_magic;
+  shared->a = shared->b = 0;
+  writers_running = writers;
+
+  std::vector<pthread_t> tids(readers + writers);
+  std::vector<uint64_t> reads(readers, 0);
+  double start = now();
+  for(uint32_t t = 0; t < readers; ++t)
+    pthread_create(&tids[t], NULL, reader, &reads[t]);
+  for(uint32_t t = 0; t < writers; ++t)
+    pthread_create(&tids[readers + t], NULL, writer, &swaps);
+  for(uint32_t t = 0; t < readers + writers; ++t)
+    pthread_join(tids[t], NULL);
+  double elapsed = now() - start;
+
+  uint64_t total_reads = 0;
+  for(uint32_t t = 0; t < readers; ++t)
+    total_reads += reads[t];
+
+  uint64_t freed_early = n_freed;
+  delete domain;
+  delete shared;
+
+  printf("%u readers, %u writers: %llu reads, %llu retired, "
+         "%llu freed before shutdown, %.3f s\n", readers, writers,
+         (unsigned long long)total_reads, (unsigned long long)n_retired,
+         (unsigned long long)freed_early, elapsed);
+
+  if(n_freed != n_retired) {
+    fprintf(stderr, "freed %llu of %llu retired nodes\n",
+            (unsigned long long)n_freed, (unsigned long long)n_retired);
+    return 1;
+  }
+  return 0;
+}
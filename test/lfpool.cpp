@@ -0,0 +1,131 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Contention benchmark for resource_pool, lockfree_resource_pool, and
+  magazine_resource_pool.  For 1 to N threads (doubling), each thread
+  repeatedly fetches a few buffers from a shared pool and releases
+  them again.  Output is CSV on stdout:
+
+    pool,threads,ops,seconds,ops_per_sec
+
+  where one op is a fetch plus its release.
+
+  $ ./lfpool [max threads] [ops per thread] > lfpool.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/resource_pool.hpp>
+#include <krb/lockfree_resource_pool.hpp>
+#include <krb/magazine_resource_pool.hpp>
+
+struct buffer
+{
+  char data[256];
+};
+
+static const uint32_t held = 4;
+
+template <class Pool>
+struct bench_args
+{
+  Pool *pool;
+  uint32_t ops;
+};
+
+template <class Pool>
+void * bench_thread(void *arg)
+{
+  bench_args<Pool> *A = (bench_args<Pool> *)arg;
+  buffer *b[held];
+
+  for(uint32_t i = 0; i < A->ops; i += held) {
+    for(uint32_t j = 0; j < held; ++j) {
+      b[j] = A->pool->fetch();
+      if(!b[j]) {
+        fprintf(stderr, "pool ran dry\n");
+        exit(1);
+      }
+      b[j]->data[0] = (char)j;
+    }
+    for(uint32_t j = 0; j < held; ++j)
+      A->pool->release(b[j]);
+  }
+
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Pool>
+void bench(const char *name, uint32_t threads, uint32_t ops)
+{
+  // leave enough headroom for every thread's magazine to be full
+  Pool pool(16, threads * (held + 16));
+  bench_args<Pool> A = { &pool, ops };
+  std::vector<pthread_t> tids(threads);
+
+  double start = now();
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_create(&tids[t], NULL, bench_thread<Pool>, &A);
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+  double secs = now() - start;
+
+  uint64_t total = (uint64_t)threads * ops;
+  printf("%s,%u,%llu,%.6f,%.1f\n", name, threads,
+         (unsigned long long)total, secs, total / secs);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_threads = (argc > 1) ? atoi(argv[1]) : 8;
+  uint32_t ops = (argc > 2) ? atoi(argv[2]) : 1000000;
+
+  if(max_threads == 0 || ops == 0) {
+    fprintf(stderr, "Usage: %s [max threads] [ops per thread]\n", argv[0]);
+    return 1;
+  }
+
+  printf("pool,threads,ops,seconds,ops_per_sec\n");
+  for(uint32_t t = 1; t <= max_threads; t *= 2) {
+    bench< resource_pool<buffer> >("resource_pool", t, ops);
+    bench< lockfree_resource_pool<buffer> >("lockfree_resource_pool", t, ops);
+    bench< magazine_resource_pool<buffer> >("magazine_resource_pool", t, ops);
+  }
+
+  return 0;
+}
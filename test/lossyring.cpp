@@ -0,0 +1,185 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Exercise the overwrite-oldest rings.  First, keep the tail of a byte
+  stream in a ring_buffer with write_overwrite() and check it against
+  the stream.  Then have several threads append records to a
+  lossy_ring as fast as they can while the main thread takes
+  snapshots, and check that every record in every snapshot is intact
+  and that snapshots are in order.  Finally, report how expensive a
+  write is.
+
+  $ ./lossyring [writer threads] [records per thread]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/ring_buffer.hpp>
+#include <krb/lossy_ring.hpp>
+
+struct request_record
+{
+  uint32_t thread;
+  uint32_t serial;
+  uint64_t payload[4];
+  uint64_t check;
+
+  void fill(uint32_t t, uint32_t s)
+  {
+    thread = t;
+    serial = s;
+    check = 0;
+    for(uint32_t i = 0; i < 4; ++i)
+      check ^= payload[i] = ((uint64_t)t << 32 | s) * (i + 0x9e3779b97f4a7c15ULL);
+  }
+
+  bool intact() const
+  {
+    uint64_t c = 0;
+    for(uint32_t i = 0; i < 4; ++i) {
+      if(payload[i] != ((uint64_t)thread << 32 | serial) *
+                       (i + 0x9e3779b97f4a7c15ULL))
+        return false;
+      c ^= payload[i];
+    }
+    return c == check;
+  }
+};
+
+struct writer_args
+{
+  lossy_ring<request_record> *ring;
+  uint32_t thread, records, dropped;
+};
+
+void * writer(void *arg)
+{
+  writer_args *A = (writer_args *)arg;
+  request_record r;
+  for(uint32_t i = 0; i < A->records; ++i) {
+    r.fill(A->thread, i);
+    if(!A->ring->write(r))
+      ++A->dropped;
+  }
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool test_overwrite()
+{
+  ring_buffer<char> R(100);
+  char in[37], out[100];
+  uint32_t total = 0, dropped = 0;
+
+  for(uint32_t round = 0; round < 1000; ++round) {
+    uint32_t n = 1 + round % 37;
+    for(uint32_t i = 0; i < n; ++i)
+      in[i] = (char)(total + i);
+    dropped += R.write_overwrite(in, n);
+    total += n;
+  }
+
+  uint32_t kept = R.used();
+  if(kept != 100 || dropped != total - kept || !R.read(out, kept))
+    return false;
+  for(uint32_t i = 0; i < kept; ++i)
+    if(out[i] != (char)(total - kept + i))
+      return false;
+
+  printf("ring_buffer: kept the last %u of %u bytes\n", kept, total);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t threads = (argc > 1) ? atoi(argv[1]) : 4;
+  uint32_t records = (argc > 2) ? atoi(argv[2]) : 1000000;
+
+  if(threads == 0 || records == 0) {
+    fprintf(stderr, "Usage: %s [writer threads] [records per thread]\n",
+            argv[0]);
+    return 1;
+  }
+
+  if(!test_overwrite()) {
+    fprintf(stderr, "write_overwrite kept the wrong data\n");
+    return 1;
+  }
+
+  lossy_ring<request_record> ring(1024);
+  std::vector<writer_args> A(threads);
+  std::vector<pthread_t> tids(threads);
+
+  double start = now();
+  for(uint32_t t = 0; t < threads; ++t) {
+    writer_args a = { &ring, t, records, 0 };
+    A[t] = a;
+    pthread_create(&tids[t], NULL, writer, &A[t]);
+  }
+
+  // snapshot while the writers are going
+  std::vector<request_record> snap(ring.capacity());
+  std::vector<uint64_t> pos(ring.capacity());
+  uint32_t snapshots = 0;
+  uint64_t seen = 0;
+  while(ring.written() < (uint64_t)threads * records) {
+    uint32_t n = ring.snapshot(&snap[0], snap.size(), &pos[0]);
+    for(uint32_t i = 0; i < n; ++i) {
+      if(!snap[i].intact() || (i > 0 && pos[i] <= pos[i-1])) {
+        fprintf(stderr, "snapshot %u has a bad record\n", snapshots);
+        return 1;
+      }
+    }
+    ++snapshots;
+    seen += n;
+  }
+
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+  double secs = now() - start;
+
+  uint32_t dropped = 0;
+  for(uint32_t t = 0; t < threads; ++t)
+    dropped += A[t].dropped;
+
+  uint64_t total = (uint64_t)threads * records;
+  printf("lossy_ring: %llu records from %u threads, %u dropped, "
+         "%.1f ns/write\n", (unsigned long long)total, threads, dropped,
+         secs * 1e9 / total);
+  printf("lossy_ring: %u snapshots, %.1f records each\n", snapshots,
+         snapshots ? (double)seen / snapshots : 0.0);
+
+  return 0;
+}
@@ -0,0 +1,187 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Throughput benchmark for mpmc_queue.  For every combination of 1 to
+  N producers and 1 to N consumers (doubling), producers push a total
+  of M 64-bit values through the queue and consumers pull them out;
+  the consumers' sums are checked against what was sent.  Each
+  combination is run once moving single elements (producers use the
+  blocking enqueue(), consumers try_dequeue() so they can tell when
+  they're done) and once moving batches with the bulk calls.
+  Output is CSV on stdout:
+
+    mode,producers,consumers,items,seconds,items_per_sec
+
+  $ ./mpmcbench [max threads] [items] [queue size] > mpmc.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+#include <krb/mpmc_queue.hpp>
+
+static const uint32_t batch = 32;
+
+struct bench_args
+{
+  mpmc_queue<uint64_t> *queue;
+  bool bulk;
+  uint32_t items;       // for a producer: how many to send
+  volatile uint32_t *remaining; // shared by consumers: how many left to get
+  uint64_t sum;
+};
+
+void * producer(void *arg)
+{
+  bench_args *A = (bench_args *)arg;
+  uint64_t b[batch];
+  uint32_t sent = 0;
+
+  while(sent < A->items) {
+    if(!A->bulk) {
+      A->queue->enqueue(sent + 1);
+      A->sum += sent + 1;
+      ++sent;
+      continue;
+    }
+
+    uint32_t n = std::min(batch, A->items - sent);
+    for(uint32_t i = 0; i < n; ++i)
+      b[i] = sent + i + 1;
+
+    uint32_t done = 0;
+    while(done < n) {
+      uint32_t k = A->queue->try_enqueue_bulk(b + done, n - done);
+      if(k == 0)
+        sched_yield();
+      done += k;
+    }
+
+    for(uint32_t i = 0; i < n; ++i)
+      A->sum += b[i];
+    sent += n;
+  }
+
+  return NULL;
+}
+
+void * consumer(void *arg)
+{
+  bench_args *A = (bench_args *)arg;
+  uint64_t b[batch];
+
+  while(*A->remaining > 0) {
+    uint32_t k;
+    if(A->bulk)
+      k = A->queue->try_dequeue_bulk(b, batch);
+    else
+      k = A->queue->try_dequeue(b[0]) ? 1 : 0;
+
+    if(k == 0) {
+      sched_yield();
+      continue;
+    }
+
+    for(uint32_t i = 0; i < k; ++i)
+      A->sum += b[i];
+    __sync_fetch_and_sub(A->remaining, k);
+  }
+
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench(bool bulk, uint32_t producers, uint32_t consumers,
+           uint32_t items, uint32_t size)
+{
+  mpmc_queue<uint64_t> queue(size);
+  volatile uint32_t remaining = (items / producers) * producers;
+  std::vector<bench_args> P(producers), C(consumers);
+  std::vector<pthread_t> tids(producers + consumers);
+
+  double start = now();
+  for(uint32_t i = 0; i < producers; ++i) {
+    bench_args a = { &queue, bulk, items / producers, NULL, 0 };
+    P[i] = a;
+    pthread_create(&tids[i], NULL, producer, &P[i]);
+  }
+  for(uint32_t i = 0; i < consumers; ++i) {
+    bench_args a = { &queue, bulk, 0, &remaining, 0 };
+    C[i] = a;
+    pthread_create(&tids[producers + i], NULL, consumer, &C[i]);
+  }
+  for(uint32_t i = 0; i < tids.size(); ++i)
+    pthread_join(tids[i], NULL);
+  double secs = now() - start;
+
+  uint64_t sent = 0, got = 0;
+  for(uint32_t i = 0; i < producers; ++i)
+    sent += P[i].sum;
+  for(uint32_t i = 0; i < consumers; ++i)
+    got += C[i].sum;
+  if(sent != got || !queue.empty()) {
+    fprintf(stderr, "sent %llu but got %llu\n",
+            (unsigned long long)sent, (unsigned long long)got);
+    exit(1);
+  }
+
+  uint32_t total = (items / producers) * producers;
+  printf("%s,%u,%u,%u,%.6f,%.1f\n", bulk ? "bulk" : "single",
+         producers, consumers, total, secs, total / secs);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_threads = (argc > 1) ? atoi(argv[1]) : 4;
+  uint32_t items = (argc > 2) ? atoi(argv[2]) : 2000000;
+  uint32_t size = (argc > 3) ? atoi(argv[3]) : 1024;
+
+  if(max_threads == 0 || items == 0 || size == 0) {
+    fprintf(stderr, "Usage: %s [max threads] [items] [queue size]\n",
+            argv[0]);
+    return 1;
+  }
+
+  printf("mode,producers,consumers,items,seconds,items_per_sec\n");
+  for(uint32_t p = 1; p <= max_threads; p *= 2)
+    for(uint32_t c = 1; c <= max_threads; c *= 2) {
+      bench(false, p, c, items, size);
+      bench(true, p, c, items, size);
+    }
+
+  return 0;
+}
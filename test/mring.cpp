@@ -0,0 +1,93 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Exercise mirrored_ring_buffer: push variable-length records through
+  a small ring so that many of them straddle the wrap point, and parse
+  each one in place through the pointer peek() returns.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <krb/mirrored_ring_buffer.hpp>
+#include <krb/exceptions.hpp>
+
+// a record is a length byte followed by that many copies of a tag
+// byte
+static uint32_t make_record(char *rec, uint32_t i)
+{
+  uint8_t len = 1 + (i * 37) % 200;
+  rec[0] = (char)len;
+  memset(rec + 1, 'a' + i % 26, len);
+  return len + 1;
+}
+
+int main(int argc, char **argv)
+{
+  try {
+    mirrored_ring_buffer R(4096);
+    printf("capacity %u\n", R.capacity());
+
+    char rec[256];
+    uint32_t written = 0, parsed = 0, wrapped = 0, offset = 0;
+
+    while(parsed < 100000) {
+
+      // fill the ring with whole records
+      while(written < 100000) {
+        uint32_t n = make_record(rec, written);
+        if(!R.write(rec, n))
+          break;
+        ++written;
+      }
+
+      // parse records straight out of the ring
+      const char *p;
+      while((p = R.peek(1)) && R.peek(1 + (uint8_t)p[0])) {
+        uint32_t len = (uint8_t)p[0];
+        uint32_t expect = make_record(rec, parsed);
+        if(len + 1 != expect || memcmp(p, rec, expect) != 0) {
+          fprintf(stderr, "record %u is corrupt\n", parsed);
+          return 1;
+        }
+        if(offset + len + 1 > R.capacity())
+          ++wrapped;
+        offset = (offset + len + 1) % R.capacity();
+        R.read_advance(len + 1);
+        ++parsed;
+      }
+    }
+
+    printf("parsed %u records in place, %u across the wrap point\n",
+           parsed, wrapped);
+
+  } catch(const string_exception &e) {
+    fprintf(stderr, "%s\n", e.reason().c_str());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Exercise object_ring with non-trivial element types: check that
+  every element constructed is destroyed exactly once, that strings
+  survive wrapping around the ring and bulk/span operations intact,
+  and (when built as C++11 or C++0x) that move-only types work.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <krb/object_ring.hpp>
+#ifdef KRB_OBJECT_RING_MOVE
+#include <memory>
+#endif
+
+static int live = 0;
+
+struct counted
+{
+  int v;
+  counted(int x = 0) : v(x) { ++live; }
+  counted(const counted &c) : v(c.v) { ++live; }
+  counted & operator=(const counted &c) { v = c.v; return *this; }
+  ~counted() { --live; }
+};
+
+#define CHECK(cond)                                               \
+  do {                                                            \
+    if(!(cond)) {                                                 \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                    \
+    }                                                             \
+  } while(0)
+
+static std::string name(uint32_t i)
+{
+  char b[64];
+  snprintf(b, sizeof(b), "element number %u, long enough to allocate", i);
+  return b;
+}
+
+int main()
+{
+  // construction/destruction balance, including elements left in the
+  // ring when it's destroyed
+  {
+    object_ring<counted> R(5);
+    CHECK(R.capacity() == 8);
+    for(int i = 0; i < 1000; ++i) {
+      CHECK(R.push(counted(i)));
+      if(R.full()) {
+        counted c;
+        CHECK(R.pop(c) && c.v == i - 7);
+      }
+    }
+    CHECK(live == 7);
+  }
+  CHECK(live == 0);
+
+  // strings through push/pop, bulk, and spans
+  {
+    object_ring<std::string> R(16);
+    std::vector<std::string> in, out(7);
+    uint32_t next_in = 0, next_out = 0;
+
+    for(uint32_t round = 0; round < 1000; ++round) {
+      in.clear();
+      for(uint32_t i = 0; i < 1 + round % 11; ++i)
+        in.push_back(name(next_in + i));
+      next_in += R.push_bulk(&in[0], in.size());
+
+      // construct a couple more in place through a span
+      uint32_t n = 2;
+      std::string *p = R.emplace_span(n);
+      for(uint32_t i = 0; i < n; ++i)
+        new (p + i) std::string(name(next_in + i));
+      R.emplace_commit(n);
+      next_in += n;
+
+      uint32_t got = R.pop_bulk(&out[0], 1 + round % 7);
+      for(uint32_t i = 0; i < got; ++i)
+        CHECK(out[i] == name(next_out++));
+
+      // and look at some in place
+      n = 3;
+      const std::string *q = R.pop_span(n);
+      for(uint32_t i = 0; i < n; ++i)
+        CHECK(q[i] == name(next_out + i));
+      R.pop_commit(n);
+      next_out += n;
+    }
+
+    while(!R.empty()) {
+      CHECK(R.front() == name(next_out++));
+      R.pop_front();
+    }
+    CHECK(next_in == next_out);
+    printf("moved %u strings through the ring\n", next_out);
+  }
+
+#ifdef KRB_OBJECT_RING_MOVE
+  // move-only elements
+  {
+    object_ring< std::unique_ptr<counted> > R(4);
+    for(int i = 0; i < 100; ++i) {
+      CHECK(R.emplace(new counted(i)));
+      std::unique_ptr<counted> p(new counted(-i));
+      CHECK(R.push(std::move(p)) && !p);
+      std::unique_ptr<counted> a, b;
+      CHECK(R.pop(a) && a->v == i && R.pop(b) && b->v == -i);
+    }
+    CHECK(R.empty());
+    printf("moved unique_ptrs through the ring\n");
+  }
+  CHECK(live == 0);
+#endif
+
+  printf("ok\n");
+  return 0;
+}
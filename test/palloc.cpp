@@ -0,0 +1,158 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Node churn benchmark for pool_allocator versus std::allocator.  For
+  1 to N threads (doubling), each thread keeps a list and a multimap
+  of a fixed size and repeatedly erases the oldest element and inserts
+  a new one, and runs an lru_cache_t with a working set larger than
+  the cache.  Output is CSV on stdout:
+
+    container,allocator,threads,ops,seconds,ops_per_sec
+
+  $ ./palloc [max threads] [ops per thread] > palloc.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <krb/pool_allocator.hpp>
+#include <krb/lru_cache.hpp>
+
+static const uint32_t live = 1000;
+
+template <class Alloc>
+struct list_churn
+{
+  static void run(uint32_t ops)
+  {
+    std::list<uint64_t, typename Alloc::template rebind<uint64_t>::other> l;
+    for(uint32_t i = 0; i < ops; ++i) {
+      l.push_back(i);
+      if(l.size() > live)
+        l.pop_front();
+    }
+  }
+};
+
+template <class Alloc>
+struct map_churn
+{
+  typedef std::pair<const uint32_t, uint64_t> value_type;
+
+  static void run(uint32_t ops)
+  {
+    std::multimap
+      <uint32_t, uint64_t, std::less<uint32_t>,
+       typename Alloc::template rebind<value_type>::other> m;
+    for(uint32_t i = 0; i < ops; ++i) {
+      m.insert(value_type(i % 977, i));
+      if(m.size() > live)
+        m.erase(m.begin());
+    }
+  }
+};
+
+template <class Alloc>
+struct lru_churn
+{
+  static void run(uint32_t ops)
+  {
+    lru_cache_t<uint32_t, uint64_t,
+                typename Alloc::template rebind<uint64_t>::other> C(live);
+    uint32_t x = 2463534242u; // xorshift; mt_rand isn't thread safe
+    for(uint32_t i = 0; i < ops; ++i) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      uint32_t k = x % (4 * live);
+      if(!C.lookup(k))
+        C.insert(k, i);
+    }
+  }
+};
+
+template <class Churn>
+void * bench_thread(void *arg)
+{
+  Churn::run(*(uint32_t *)arg);
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Churn>
+void bench(const char *container, const char *alloc,
+           uint32_t threads, uint32_t ops)
+{
+  std::vector<pthread_t> tids(threads);
+
+  double start = now();
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_create(&tids[t], NULL, bench_thread<Churn>, &ops);
+  for(uint32_t t = 0; t < threads; ++t)
+    pthread_join(tids[t], NULL);
+  double secs = now() - start;
+
+  uint64_t total = (uint64_t)threads * ops;
+  printf("%s,%s,%u,%llu,%.6f,%.1f\n", container, alloc, threads,
+         (unsigned long long)total, secs, total / secs);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_threads = (argc > 1) ? atoi(argv[1]) : 8;
+  uint32_t ops = (argc > 2) ? atoi(argv[2]) : 1000000;
+
+  if(max_threads == 0 || ops == 0) {
+    fprintf(stderr, "Usage: %s [max threads] [ops per thread]\n", argv[0]);
+    return 1;
+  }
+
+  typedef std::allocator<void> std_alloc;
+  typedef pool_allocator<void> pool_alloc;
+
+  printf("container,allocator,threads,ops,seconds,ops_per_sec\n");
+  for(uint32_t t = 1; t <= max_threads; t *= 2) {
+    bench< list_churn<std_alloc> >("list", "std", t, ops);
+    bench< list_churn<pool_alloc> >("list", "pool", t, ops);
+    bench< map_churn<std_alloc> >("multimap", "std", t, ops);
+    bench< map_churn<pool_alloc> >("multimap", "pool", t, ops);
+    bench< lru_churn<std_alloc> >("lru_cache", "std", t, ops);
+    bench< lru_churn<pool_alloc> >("lru_cache", "pool", t, ops);
+  }
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Benchmarks for parallel_for/parallel_reduce on a few of the
+  library's own structures.  Each benchmark is run once serially and
+  once on a thread pool, and the results are checked against each
+  other.
+
+  $ ./parallel 4000000 8
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <vector>
+#include <krb/parallel.hpp>
+#include <krb/bloom_filter.hpp>
+#include <krb/counting_bloom_filter.hpp>
+#include <krb/murmur_hash.hpp>
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, double serial, double parallel)
+{
+  printf("%-24s serial %8.4fs  parallel %8.4fs  speedup %5.2fx\n",
+         name, serial, parallel, serial / parallel);
+}
+
+// hash every key into an output array
+struct hash_body
+{
+  hash_body(const std::vector<uint64_t> &k, std::vector<uint32_t> &o)
+    : keys(k), out(o) {}
+
+  void operator()(uint64_t b, uint64_t e)
+  {
+    for(uint64_t i = b; i < e; ++i)
+      out[i] = H(&keys[i], sizeof(keys[i]), 0);
+  }
+
+  const std::vector<uint64_t> &keys;
+  std::vector<uint32_t> &out;
+  murmur_hash H;
+};
+
+// count the keys a Bloom filter claims to contain
+template <class Filter>
+struct query_body
+{
+  query_body(const Filter &f, const std::vector<uint64_t> &k)
+    : F(f), keys(k) {}
+
+  uint64_t operator()(uint64_t b, uint64_t e, uint64_t acc)
+  {
+    for(uint64_t i = b; i < e; ++i)
+      if(F.query(&keys[i], sizeof(keys[i])))
+        ++acc;
+    return acc;
+  }
+
+  const Filter &F;
+  const std::vector<uint64_t> &keys;
+};
+
+struct sum
+{
+  uint64_t operator()(uint64_t a, uint64_t b) const { return a + b; }
+};
+
+template <class Filter>
+void bench_filter
+  (const char *name, thread_pool<> &T, const std::vector<uint64_t> &keys)
+{
+  // fill the filter with every other key, then ask about all of them
+  Filter F(keys.size() / 2, 0.01);
+  for(uint64_t i = 0; i < keys.size(); i += 2)
+    F.add(&keys[i], sizeof(keys[i]));
+
+  query_body<Filter> body(F, keys);
+  sum combine;
+
+  double t0 = now();
+  uint64_t expected = body(0, keys.size(), 0);
+  double t1 = now();
+  uint64_t found = parallel_reduce
+    (T, 0, keys.size(), 4096, (uint64_t)0, body, combine);
+  double t2 = now();
+
+  if(found != expected) {
+    printf("%s: MISMATCH, serial %llu, parallel %llu\n", name,
+           (unsigned long long)expected, (unsigned long long)found);
+    exit(1);
+  }
+
+  report(name, t1 - t0, t2 - t1);
+}
+
+int main(int argc, char **argv)
+{
+  if(argc < 3) {
+    printf("Usage: %s <# keys> <# threads>\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t N = strtoull(argv[1], NULL, 10);
+  uint32_t N_threads = atoi(argv[2]);
+
+  struct event_base *ev_base = (event_base *)event_init();
+  thread_pool<> T(N_threads, N_threads, ev_base);
+
+  std::vector<uint64_t> keys(N);
+  srandom(1);
+  for(uint64_t i = 0; i < N; ++i)
+    keys[i] = ((uint64_t)random() << 32) | random();
+
+  // murmur hashing
+  std::vector<uint32_t> serial_out(N), parallel_out(N);
+  hash_body serial_body(keys, serial_out), parallel_body(keys, parallel_out);
+
+  double t0 = now();
+  serial_body(0, N);
+  double t1 = now();
+  parallel_for(T, 0, N, 4096, parallel_body);
+  double t2 = now();
+
+  if(serial_out != parallel_out) {
+    printf("murmur_hash: MISMATCH\n");
+    return 1;
+  }
+  report("murmur_hash", t1 - t0, t2 - t1);
+
+  // Bloom filter queries
+  bench_filter<bloom_filter>("bloom_filter", T, keys);
+  bench_filter< counting_bloom_filter<> >("counting_bloom_filter", T, keys);
+
+  return 0;
+}
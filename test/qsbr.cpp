@@ -0,0 +1,179 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Compares synchronizer_t (stop the workers at a barrier while the
+  config is replaced) with qsbr_synchronizer_t (swap the config, wait
+  for a grace period, delete the old one).  Worker threads loop
+  reading a shared config and checking it's intact (deleted configs
+  are poisoned first); a writer replaces it a number of times.  Half
+  the QSBR workers also go offline and back online every so often.
+  Output is CSV on stdout:
+
+    mode,workers,updates,worker_iterations,seconds,usec_per_update
+
+  $ ./qsbr [workers] [updates] > qsbr.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/synchronizer.hpp>
+
+static const uint64_t live_magic = 0x636f6e666967ULL;
+
+struct config
+{
+  volatile uint64_t magic;
+  uint64_t a, b;
+
+  config(uint64_t v) : magic(live_magic), a(v), b(2 * v) {}
+  ~config() { magic = 0; }
+};
+
+static config * volatile shared;
+static volatile uint32_t running;
+
+static void check(const config *c)
+{
+  if(c->magic != live_magic || c->b != 2 * c->a) {
+    fprintf(stderr, "worker saw a deleted config\n");
+    exit(1);
+  }
+}
+
+struct worker_args
+{
+  synchronizer_t *barrier_sync;
+  qsbr_synchronizer_t *qsbr_sync;
+  uint32_t index;
+  int qsbr_id;
+  uint64_t iterations;
+};
+
+void * barrier_worker(void *arg)
+{
+  worker_args *A = (worker_args *)arg;
+  while(load_acquire(&running)) {
+    A->barrier_sync->wait_for_updates();
+    check(shared);
+    ++A->iterations;
+  }
+  return NULL;
+}
+
+void * qsbr_worker(void *arg)
+{
+  worker_args *A = (worker_args *)arg;
+  qsbr_synchronizer_t &S = *A->qsbr_sync;
+  int me = A->qsbr_id;
+
+  while(load_acquire(&running)) {
+    S.quiescent(me);
+    check(load_acquire(&shared));
+    ++A->iterations;
+
+    if(A->index % 2 && A->iterations % 1000 == 0) {
+      S.offline(me);
+      sched_yield();
+      S.online(me);
+    }
+  }
+
+  S.remove_thread(me);
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(bool qsbr, uint32_t workers, uint32_t updates)
+{
+  synchronizer_t barrier_sync(workers);
+  qsbr_synchronizer_t qsbr_sync(workers);
+
+  shared = new config(0);
+  running = 1;
+
+  std::vector<pthread_t> tids(workers);
+  std::vector<worker_args> args(workers);
+  for(uint32_t t = 0; t < workers; ++t) {
+    // register up front so the first update waits for everybody
+    worker_args A = { &barrier_sync, &qsbr_sync, t,
+                      qsbr ? qsbr_sync.add_thread() : -1, 0 };
+    args[t] = A;
+    pthread_create(&tids[t], NULL, qsbr ? qsbr_worker : barrier_worker,
+                   &args[t]);
+  }
+
+  double start = now();
+  for(uint32_t i = 1; i <= updates; ++i) {
+    if(qsbr)
+      qsbr_sync.update(shared, new config(i));
+    else {
+      barrier_sync.acquire_sync();
+      delete shared;
+      shared = new config(i);
+      barrier_sync.release_sync();
+    }
+  }
+  double elapsed = now() - start;
+
+  if(qsbr)
+    store_release(&running, (uint32_t)0);
+  else {
+    // stop the workers at the barrier so none is left waiting there
+    barrier_sync.acquire_sync();
+    running = 0;
+    barrier_sync.release_sync();
+  }
+  uint64_t iterations = 0;
+  for(uint32_t t = 0; t < workers; ++t) {
+    pthread_join(tids[t], NULL);
+    iterations += args[t].iterations;
+  }
+  delete shared;
+
+  printf("%s,%u,%u,%llu,%.3f,%.1f\n", qsbr ? "qsbr" : "barrier",
+         workers, updates, (unsigned long long)iterations, elapsed,
+         elapsed / updates * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t workers = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t updates = argc > 2 ? atoi(argv[2]) : 1000;
+
+  printf("mode,workers,updates,worker_iterations,seconds,usec_per_update\n");
+  run(false, workers, updates);
+  run(true, workers, updates);
+  return 0;
+}
@@ -0,0 +1,133 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Pump a byte stream through ring_buffer and mirrored_ring_buffer
+  using read_from_fd() and write_to_fd() with a couple of non-blocking
+  pipes, in odd-sized pieces so the ring wraps constantly, and check
+  that the stream comes out the other end intact.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <krb/ring_buffer.hpp>
+#include <krb/mirrored_ring_buffer.hpp>
+#include <krb/exceptions.hpp>
+
+static const uint32_t total = 10000000;
+
+static char stream_byte(uint32_t i)
+{
+  return (char)((i * 2654435761u) >> 24);
+}
+
+static void nonblocking_pipe(int fds[2])
+{
+  if(pipe(fds) < 0)
+    throw strerror_exception("Creating pipe", errno);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+// source pipe -> ring -> sink pipe
+template <class Ring>
+bool pump(const char *name, Ring &R)
+{
+  int in[2], out[2];
+  nonblocking_pipe(in);
+  nonblocking_pipe(out);
+
+  uint32_t produced = 0, consumed = 0, syscalls = 0, again = 0;
+  char chunk[8192];
+
+  for(uint32_t round = 1; consumed < total; ++round) {
+
+    // feed the source pipe
+    uint32_t n = 0;
+    for(; n < sizeof(chunk) && produced + n < total; ++n)
+      chunk[n] = stream_byte(produced + n);
+    if(n > 0) {
+      ssize_t w = write(in[1], chunk, n);
+      if(w > 0)
+        produced += w;
+    }
+    if(produced == total && in[1] >= 0) {
+      close(in[1]);
+      in[1] = -1;
+    }
+
+    // move data through the ring in odd-sized pieces
+    ssize_t rv = R.read_from_fd(in[0], 1 + (round * 7919) % 5000);
+    ++syscalls;
+    if(rv < 0 && errno == EAGAIN)
+      ++again;
+    else if(rv < 0 && errno != ENOBUFS)
+      throw strerror_exception("Reading ring buffer from pipe", errno);
+
+    rv = R.write_to_fd(out[1], 1 + (round * 104729) % 5000);
+    ++syscalls;
+    if(rv < 0 && errno == EAGAIN)
+      ++again;
+    else if(rv < 0)
+      throw strerror_exception("Writing ring buffer to pipe", errno);
+
+    // drain the sink pipe and check what came out
+    ssize_t r;
+    while((r = read(out[0], chunk, sizeof(chunk))) > 0) {
+      for(ssize_t i = 0; i < r; ++i, ++consumed) {
+        if(chunk[i] != stream_byte(consumed)) {
+          fprintf(stderr, "%s: byte %u is wrong\n", name, consumed);
+          return false;
+        }
+      }
+    }
+  }
+
+  printf("%s: %u bytes intact, %u fd calls (%u EAGAIN)\n",
+         name, consumed, syscalls, again);
+
+  close(in[0]);
+  close(out[0]);
+  close(out[1]);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  try {
+    ring_buffer<char> R(6000);
+    mirrored_ring_buffer M(6000);
+    if(!pump("ring_buffer", R) || !pump("mirrored_ring_buffer", M))
+      return 1;
+  } catch(const string_exception &e) {
+    fprintf(stderr, "%s\n", e.reason().c_str());
+    return 1;
+  }
+
+  return 0;
+}
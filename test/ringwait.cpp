@@ -0,0 +1,192 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Check that blocked ring consumers don't burn CPU.  A producer sends
+  bursts of elements with idle gaps between them, through an
+  spsc_ring_buffer to a consumer using wait_readable(), and through an
+  mpmc_queue to a few consumers using the blocking dequeue().  For each
+  consumer we report how much CPU time it used against how long it
+  ran; a spinning consumer would use nearly all of it.  Also checks
+  that wait_readable() and wait_writable() time out.
+
+  $ ./ringwait [bursts] [gap in ms]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/spsc_ring_buffer.hpp>
+#include <krb/mpmc_queue.hpp>
+
+static const uint32_t burst = 1000;
+static uint32_t bursts = 50, gap_ms = 10;
+
+static double clock_seconds(clockid_t c)
+{
+  struct timespec ts;
+  clock_gettime(c, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct consumer_stats
+{
+  uint64_t sum;
+  double cpu, wall;
+};
+
+void * spsc_consumer(void *arg)
+{
+  spsc_ring_buffer<uint32_t> *R = (spsc_ring_buffer<uint32_t> *)arg;
+  consumer_stats *S = new consumer_stats();
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  uint32_t v, got = 0;
+
+  while(got < bursts * burst) {
+    R->wait_readable(1);
+    while(R->read(&v, 1)) {
+      S->sum += v;
+      ++got;
+    }
+  }
+
+  S->wall = clock_seconds(CLOCK_MONOTONIC) - start;
+  S->cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+  return S;
+}
+
+void * mpmc_consumer(void *arg)
+{
+  mpmc_queue<uint32_t> *Q = (mpmc_queue<uint32_t> *)arg;
+  consumer_stats *S = new consumer_stats();
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  uint32_t v;
+
+  while(1) {
+    Q->dequeue(v);
+    if(v == 0) // we're done
+      break;
+    S->sum += v;
+  }
+
+  S->wall = clock_seconds(CLOCK_MONOTONIC) - start;
+  S->cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+  return S;
+}
+
+static void report(const char *name, consumer_stats *S, uint64_t expect)
+{
+  printf("%s: %.3fs cpu over %.3fs (%.1f%%)%s\n", name, S->cpu, S->wall,
+         100 * S->cpu / S->wall, S->sum == expect ? "" : " WRONG SUM");
+  if(S->sum != expect)
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  if(argc > 1)
+    bursts = atoi(argv[1]);
+  if(argc > 2)
+    gap_ms = atoi(argv[2]);
+  if(bursts == 0) {
+    fprintf(stderr, "Usage: %s [bursts] [gap in ms]\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t expect = 0;
+  for(uint32_t i = 1; i <= burst; ++i)
+    expect += i;
+  expect *= bursts;
+
+  // timeouts
+  {
+    spsc_ring_buffer<uint32_t> R(4);
+    uint32_t v = 1;
+    double start = clock_seconds(CLOCK_MONOTONIC);
+    bool r = R.wait_readable(1, 50);
+    while(R.write(&v, 1))
+      ;
+    bool w = R.wait_writable(1, 50);
+    double secs = clock_seconds(CLOCK_MONOTONIC) - start;
+    if(r || w || secs < 0.1) {
+      fprintf(stderr, "wait_readable/wait_writable didn't time out\n");
+      return 1;
+    }
+    printf("timeouts ok (%.3fs for two 50ms waits)\n", secs);
+  }
+
+  // spsc
+  {
+    spsc_ring_buffer<uint32_t> R(256);
+    pthread_t tid;
+    pthread_create(&tid, NULL, spsc_consumer, &R);
+
+    for(uint32_t b = 0; b < bursts; ++b) {
+      usleep(gap_ms * 1000);
+      for(uint32_t i = 1; i <= burst; ++i) {
+        R.wait_writable(1);
+        R.write(&i, 1);
+      }
+    }
+
+    consumer_stats *S;
+    pthread_join(tid, (void **)&S);
+    report("spsc_ring_buffer consumer", S, expect);
+    delete S;
+  }
+
+  // mpmc
+  {
+    const uint32_t consumers = 3;
+    mpmc_queue<uint32_t> Q(256);
+    std::vector<pthread_t> tids(consumers);
+    for(uint32_t c = 0; c < consumers; ++c)
+      pthread_create(&tids[c], NULL, mpmc_consumer, &Q);
+
+    for(uint32_t b = 0; b < bursts; ++b) {
+      usleep(gap_ms * 1000);
+      for(uint32_t i = 1; i <= burst; ++i)
+        Q.enqueue(i);
+    }
+    for(uint32_t c = 0; c < consumers; ++c)
+      Q.enqueue(0);
+
+    consumer_stats total = { 0, 0, 0 };
+    for(uint32_t c = 0; c < consumers; ++c) {
+      consumer_stats *S;
+      pthread_join(tids[c], (void **)&S);
+      total.sum += S->sum;
+      total.cpu += S->cpu;
+      total.wall += S->wall;
+      delete S;
+    }
+    report("mpmc_queue consumers", &total, expect);
+  }
+
+  return 0;
+}
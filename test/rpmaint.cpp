@@ -0,0 +1,166 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Tests resource_pool's housekeeping: maintain() expires resources
+  that have been idle longer than the idle timeout (but not below the
+  low watermark), resources that fail validate() are quarantined by
+  fetch() and then destroyed or put back by maintain(), and
+  allocated()/used()/free() stay right throughout.  Takes a few
+  seconds, since the idle timeout is in whole seconds.  Prints each
+  check and exits nonzero on the first failure.
+
+  $ ./rpmaint
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <krb/resource_pool.hpp>
+
+struct conn
+{
+  static int live;
+  bool broken;
+  conn() : broken(false) { ++live; }
+  conn(const conn &) : broken(false) { ++live; }
+  ~conn() { --live; }
+};
+
+int conn::live = 0;
+
+struct conn_pool : public resource_pool<conn, never_shrink_policy>
+{
+  typedef resource_pool<conn, never_shrink_policy> base;
+  conn_pool(uint32_t low, uint32_t high) : base(low, high) {}
+
+protected:
+  bool validate(conn *c) { return !c->broken; }
+};
+
+static void check(bool ok, const char *what)
+{
+  printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+  if(!ok)
+    exit(1);
+}
+
+static bool counts(conn_pool &P, uint32_t allocated, uint32_t used,
+                   uint32_t free, uint32_t quarantined)
+{
+  return P.allocated() == allocated && P.used() == used &&
+    P.free() == free && P.quarantine_size() == quarantined &&
+    conn::live == (int)allocated;
+}
+
+int main()
+{
+  // idle expiry takes the resources released longest ago
+  {
+    conn_pool P(2, 10);
+    conn *c[6];
+    for(int i = 0; i < 6; ++i)
+      c[i] = P.fetch();
+    check(counts(P, 6, 6, 0, 0), "fetched six");
+
+    check(P.maintain() == 0, "no idle timeout, nothing expires");
+
+    P.set_idle_timeout(1);
+    for(int i = 0; i < 3; ++i)
+      P.release(c[i]);
+    usleep(2200000);
+    for(int i = 3; i < 6; ++i)
+      P.release(c[i]);
+    check(counts(P, 6, 0, 6, 0), "released six");
+
+    check(P.maintain() == 3, "maintain() expires the three idle ones");
+    check(counts(P, 3, 0, 3, 0), "three left, all free");
+
+    // the survivors were the most recently released
+    conn *d = P.fetch();
+    check(d == c[5] || d == c[4] || d == c[3], "survivors are the newest");
+    P.release(d);
+  }
+
+  // expiry stops at the low watermark
+  {
+    conn_pool P(4, 10);
+    conn *c[6];
+    for(int i = 0; i < 6; ++i)
+      c[i] = P.fetch();
+    P.set_idle_timeout(1);
+    for(int i = 0; i < 6; ++i)
+      P.release(c[i]);
+    usleep(2200000);
+
+    check(P.maintain() == 2, "maintain() stops at the low watermark");
+    check(counts(P, 4, 0, 4, 0), "four left, all free");
+
+    P.set_idle_timeout(0);
+    usleep(1200000);
+    check(P.maintain() == 0, "idle timeout of 0 disables expiry");
+  }
+
+  // bad resources are quarantined and then destroyed
+  {
+    conn_pool P(0, 3);
+    conn *c[3];
+    for(int i = 0; i < 3; ++i)
+      c[i] = P.fetch();
+    c[2]->broken = true;
+    for(int i = 0; i < 3; ++i)
+      P.release(c[i]);
+
+    // the newest release (the broken one) is tried first
+    conn *a = P.fetch(), *b = P.fetch();
+    check(a && b && a != c[2] && b != c[2] && !a->broken && !b->broken,
+          "fetch() skips the bad resource");
+    check(counts(P, 3, 2, 0, 1), "bad resource in quarantine");
+    check(P.fetch() == NULL, "quarantined resource counts as allocated");
+
+    check(P.maintain() == 1, "maintain() destroys it if still bad");
+    check(counts(P, 2, 2, 0, 0), "quarantine empty, one fewer allocated");
+
+    // room to grow again
+    conn *d = P.fetch();
+    check(d != NULL && counts(P, 3, 3, 0, 0), "pool grows back");
+
+    // this time the resource recovers before maintain() looks again
+    d->broken = true;
+    P.release(d);
+    check(P.fetch() == NULL && counts(P, 3, 2, 0, 1),
+          "recovering resource quarantined");
+    d->broken = false;
+    check(P.maintain() == 0, "maintain() keeps it once it's good");
+    check(counts(P, 3, 2, 1, 0), "back on the free list");
+
+    P.release(a);
+    P.release(b);
+    check(counts(P, 3, 0, 3, 0), "everything returned");
+  }
+
+  check(conn::live == 0, "every resource destroyed with its pool");
+  return 0;
+}
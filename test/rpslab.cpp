@@ -0,0 +1,273 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Tests the storage underneath the resource pools.  resource_slab:
+  slot indices are unique and dense, slot_of() finds a resource's
+  slot, vacant slots are reused before the slab grows, slot addresses
+  don't move when the chunk table grows, capacity never shrinks, and
+  the slab destroys leftover resources.  resource_pool's free ring:
+  against a model, over many random fetches and releases (enough to
+  grow and wrap the ring), fetch() always returns the most recently
+  released resource and free() matches; a shrink takes the resources
+  released longest ago; a resource constructor that throws doesn't
+  cost the pool a slot.  Prints each check and exits nonzero on the
+  first failure.
+
+  $ ./rpslab
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <krb/resource_slab.hpp>
+#include <krb/resource_pool.hpp>
+
+struct widget
+{
+  static int live;
+  uint32_t payload;
+  widget() : payload(0) { ++live; }
+  widget(const widget &) : payload(0) { ++live; }
+  ~widget() { --live; }
+};
+
+int widget::live = 0;
+
+struct no_links {};
+
+// a resource whose constructor fails on demand
+struct fragile
+{
+  static bool fail;
+  fragile() { if(fail) throw 1; }
+};
+
+bool fragile::fail = false;
+
+static void check(bool ok, const char *what)
+{
+  printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+  if(!ok)
+    exit(1);
+}
+
+static uint32_t rng = 2463534242U;
+
+static uint32_t next_rand()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// grows one at a time and never shrinks, so the model knows exactly
+// what's free
+struct one_at_a_time_policy
+{
+  uint32_t grow(uint32_t allocated) { return 1; }
+  uint32_t shrink(uint32_t allocated, uint32_t free) { return 0; }
+};
+
+// shrinks to half the free resources whenever more than half are free
+struct halving_policy
+{
+  uint32_t grow(uint32_t allocated) { return 1; }
+  uint32_t shrink(uint32_t allocated, uint32_t free)
+  {
+    return free > allocated / 2 ? free / 2 : 0;
+  }
+};
+
+struct fragile_pool : public resource_pool<fragile, one_at_a_time_policy>
+{
+  typedef resource_pool<fragile, one_at_a_time_policy> base;
+  fragile_pool(uint32_t low, uint32_t high) : base(low, high) {}
+  uint32_t slab_capacity() const { return slab.capacity(); }
+};
+
+template <class Pool>
+void random_ops(const char *label)
+{
+  Pool P(0, 5000);
+  std::vector<widget *> out;
+  std::deque<widget *> model; // free resources, oldest first
+  bool lifo = true, counts = true;
+
+  for(uint32_t step = 0; step < 200000; ++step) {
+    if(out.empty() || (next_rand() % 100 < 55 && out.size() < 3000)) {
+      widget *w = P.fetch();
+      if(!model.empty()) {
+        lifo = lifo && w == model.back();
+        model.pop_back();
+      }
+      out.push_back(w);
+    } else {
+      uint32_t k = next_rand() % out.size();
+      std::swap(out[k], out.back());
+      P.release(out.back());
+      model.push_back(out.back());
+      out.pop_back();
+
+      // whatever a shrink destroyed came off the old end
+      while(model.size() + out.size() > P.allocated())
+        model.pop_front();
+    }
+    counts = counts && P.free() == model.size() &&
+      P.used() == out.size() && widget::live == (int)P.allocated();
+  }
+
+  char what[128];
+  snprintf(what, sizeof(what), "%s: fetch() returns newest release", label);
+  check(lifo, what);
+  snprintf(what, sizeof(what), "%s: free()/used()/live match model", label);
+  check(counts, what);
+
+  for(uint32_t k = 0; k < out.size(); ++k)
+    P.release(out[k]);
+  snprintf(what, sizeof(what), "%s: everything back on free list", label);
+  check(P.free() == P.allocated(), what);
+}
+
+int main()
+{
+  {
+    typedef resource_slab<widget, no_links, 3> slab_type; // 8 per chunk
+    slab_type S;
+
+    std::vector<uint32_t> idx;
+    std::set<uint32_t> seen;
+    for(uint32_t n = 0; n < 100; ++n) {
+      uint32_t i = S.allocate();
+      S.construct(i)->payload = i;
+      idx.push_back(i);
+      seen.insert(i);
+    }
+    check(seen.size() == 100 && *seen.rbegin() == 99,
+          "100 unique, dense slot indices");
+    check(S.capacity() == 104 && S.live() == 100 && widget::live == 100,
+          "capacity in whole chunks, live count right");
+
+    bool found = true;
+    for(uint32_t k = 0; k < idx.size(); ++k) {
+      widget *w = S[idx[k]].resource();
+      found = found && slab_type::slot_of(w)->index == idx[k] &&
+        w->payload == idx[k];
+    }
+    check(found, "slot_of() maps each resource back to its slot");
+
+    // addresses stay put while the chunk table grows
+    slab_type::slot *first = &S[0];
+    for(uint32_t n = 0; n < 1000; ++n)
+      S.construct(S.allocate());
+    check(&S[0] == first && S[0].resource()->payload == 0,
+          "slots don't move when the table grows");
+
+    // free half, then allocate them again without growing
+    uint32_t cap = S.capacity();
+    for(uint32_t k = 0; k < idx.size(); k += 2) {
+      S.destroy(idx[k]);
+      S.deallocate(idx[k]);
+    }
+    check(S.live() == 1050 && widget::live == 1050,
+          "destroy() decrements live counts");
+    check(S.capacity() == cap, "capacity doesn't shrink");
+    std::set<uint32_t> again;
+    for(uint32_t k = 0; k < idx.size(); k += 2)
+      again.insert(S.allocate());
+    bool reused = S.capacity() == cap;
+    for(uint32_t k = 0; k < idx.size(); k += 2)
+      reused = reused && again.count(idx[k]);
+    check(reused, "vacant slots reused before growing");
+    for(std::set<uint32_t>::iterator i = again.begin(); i != again.end(); ++i)
+      S.construct(*i);
+  }
+  check(widget::live == 0, "slab destroys leftover resources");
+
+  // the free ring is a stack for fetch(), in release order, and
+  // shrinks take from the other end; with shrinking, the ring's head
+  // moves and it wraps around
+  random_ops< resource_pool<widget, one_at_a_time_policy> >("no shrink");
+  check(widget::live == 0, "pool destroys its resources");
+  random_ops< resource_pool<widget, halving_policy> >("shrinking");
+  check(widget::live == 0, "pool destroys its resources");
+
+  // shrinks destroy the oldest free resources
+  {
+    resource_pool<widget, halving_policy> P(0, 100);
+    std::vector<widget *> out;
+    for(uint32_t n = 0; n < 10; ++n) {
+      out.push_back(P.fetch());
+      out.back()->payload = n;
+    }
+
+    // release 0..5 in order; at the sixth release more than half are
+    // free, so the three released first go
+    for(uint32_t n = 0; n < 6; ++n)
+      P.release(out[n]);
+    check(P.allocated() == 7 && P.free() == 3 && widget::live == 7,
+          "shrink destroyed three");
+
+    bool newest = true;
+    for(uint32_t n = 0; n < 3; ++n) {
+      widget *w = P.fetch();
+      newest = newest && w->payload == 5 - n;
+    }
+    check(newest, "survivors are the most recently released");
+  }
+
+  // a constructor that throws gives its slot back
+  {
+    fragile_pool P(0, 100000);
+    fragile *f = P.fetch();
+    uint32_t cap = P.slab_capacity();
+
+    fragile::fail = true;
+    uint32_t thrown = 0;
+    for(uint32_t n = 0; n < 10000; ++n) {
+      try {
+        P.fetch();
+      } catch(int) {
+        ++thrown;
+      }
+    }
+    fragile::fail = false;
+    check(thrown == 10000 && P.allocated() == 1,
+          "failed constructions aren't counted");
+    check(P.slab_capacity() == cap, "failed constructions don't leak slots");
+
+    fragile *g = P.fetch();
+    check(g != NULL && g != f && P.allocated() == 2,
+          "pool grows again afterwards");
+    P.release(f);
+    P.release(g);
+  }
+
+  return 0;
+}
@@ -0,0 +1,306 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Tests resource_pool's waiting fetches: fetch_wait() and fetch_async()
+  waiters are served in FIFO order, fetch_wait() times out, cancel_async()
+  works before a callback is granted a resource and fails after, a
+  waiter handed a resource that fails validate() quarantines it and
+  keeps waiting, maintain() serves waiters when destroying resources
+  leaves room to grow, a plain fetch() doesn't jump the line, and
+  destroying a pool wakes up threads still waiting on it.  Prints each
+  check and exits nonzero on the first failure.
+
+  $ ./rpwait
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/resource_pool.hpp>
+#include <krb/atomic_ops.hpp>
+
+struct conn
+{
+  bool broken;
+  conn() : broken(false) {}
+};
+
+struct conn_pool : public resource_pool<conn, never_shrink_policy>
+{
+  typedef resource_pool<conn, never_shrink_policy> base;
+  conn_pool(uint32_t low, uint32_t high) : base(low, high) {}
+
+  // make room to grow without releasing anything
+  void raise_high_watermark(uint32_t high)
+  {
+    locker L(mutex);
+    wm_high = high;
+  }
+
+protected:
+  bool validate(conn *c) { return !c->broken; }
+};
+
+static void check(bool ok, const char *what)
+{
+  printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+  if(!ok)
+    exit(1);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// wait for the pool's waiter count to reach n
+static void await_waiters(conn_pool &P, uint32_t n)
+{
+  while(P.waiting() != n)
+    usleep(1000);
+}
+
+// records the order in which waiters were served
+static pthread_mutex_t order_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int> order;
+
+static void served(int id)
+{
+  locker L(order_mutex);
+  order.push_back(id);
+}
+
+struct waiter_args
+{
+  conn_pool *P;
+  int id;
+  uint32_t timeout_ms;
+  conn *got;
+  bool pass_on; // release what we got right away
+};
+
+void * waiter(void *arg)
+{
+  waiter_args *A = (waiter_args *)arg;
+  A->got = A->P->fetch_wait(A->timeout_ms);
+  if(A->got) {
+    served(A->id);
+    if(A->pass_on)
+      A->P->release(A->got);
+  }
+  return NULL;
+}
+
+struct recording_callback : public resource_pool_callback<conn>
+{
+  int id;
+  conn *got;
+  recording_callback(int i) : id(i), got(NULL) {}
+  void operator()(conn *c) { got = c; served(id); }
+};
+
+int main()
+{
+  // sync waiters are served first come, first served
+  {
+    conn_pool P(0, 2);
+    conn *a = P.fetch(), *b = P.fetch();
+    check(a && b && !P.fetch(), "pool of two is exhausted");
+
+    waiter_args A[3];
+    pthread_t tids[3];
+    for(int i = 0; i < 3; ++i) {
+      waiter_args W = { &P, i, 10000, NULL, true };
+      A[i] = W;
+      pthread_create(&tids[i], NULL, waiter, &A[i]);
+      await_waiters(P, i + 1);
+    }
+
+    order.clear();
+    P.release(a); // passed along from waiter to waiter
+    for(int i = 0; i < 3; ++i)
+      pthread_join(tids[i], NULL);
+    check(order.size() == 3 && order[0] == 0 && order[1] == 1 &&
+          order[2] == 2, "fetch_wait() waiters served in FIFO order");
+    check(P.waiting() == 0 && P.used() == 1, "no waiters left over");
+    P.release(b);
+  }
+
+  // sync and async waiters share one line
+  {
+    conn_pool P(0, 1);
+    conn *a = P.fetch();
+
+    waiter_args A = { &P, 0, 10000, NULL, false };
+    pthread_t tid;
+    pthread_create(&tid, NULL, waiter, &A);
+    await_waiters(P, 1);
+
+    recording_callback cb(1);
+    P.fetch_async(&cb);
+    check(P.waiting() == 2 && cb.got == NULL,
+          "fetch_async() queues behind fetch_wait()");
+
+    order.clear();
+    P.release(a);
+    pthread_join(tid, NULL);
+    check(A.got == a && cb.got == NULL, "first release goes to the thread");
+    P.release(A.got);
+    check(cb.got == a && order.size() == 2 && order[1] == 1,
+          "second release goes to the callback");
+    check(!P.cancel_async(&cb), "cancel_async() after the grant fails");
+    P.release(cb.got);
+  }
+
+  // timeouts and cancellation
+  {
+    conn_pool P(0, 1);
+    conn *a = P.fetch();
+
+    double start = now();
+    conn *c = P.fetch_wait(100);
+    double waited = now() - start;
+    check(c == NULL && waited >= 0.095 && waited < 2,
+          "fetch_wait() times out after its timeout");
+    check(P.waiting() == 0, "timed out waiter is out of line");
+    check(P.fetch_wait(0) == NULL, "fetch_wait(0) doesn't wait");
+
+    recording_callback cb(0);
+    P.fetch_async(&cb);
+    check(P.cancel_async(&cb), "cancel_async() before the grant works");
+    P.release(a);
+    check(cb.got == NULL && P.free() == 1,
+          "canceled callback isn't called; resource goes back");
+
+    // with a free resource, fetch_async() calls back right away
+    recording_callback now_cb(1);
+    P.fetch_async(&now_cb);
+    check(now_cb.got == a, "fetch_async() calls back immediately");
+    P.release(a);
+  }
+
+  // a waiter handed a resource that fails validation quarantines it
+  // and waits for another
+  {
+    conn_pool P(0, 2);
+    conn *a = P.fetch(), *b = P.fetch();
+
+    waiter_args A = { &P, 0, 10000, NULL, false };
+    pthread_t tid;
+    pthread_create(&tid, NULL, waiter, &A);
+    await_waiters(P, 1);
+
+    a->broken = true;
+    P.release(a);
+    await_waiters(P, 1); // back in line after quarantining a
+
+    P.release(b);
+    pthread_join(tid, NULL);
+    check(P.quarantine_size() == 1,
+          "bad resource quarantined by the waiter");
+    check(A.got == b, "waiter retried and got a good resource");
+    check(P.allocated() == 2 && P.used() == 1,
+          "quarantined resource still counted");
+    P.release(b);
+  }
+
+  // destroying a quarantined resource makes room to grow, and
+  // maintain() uses it to serve the waiters at the front of the line
+  {
+    conn_pool P(0, 1);
+    conn *a = P.fetch();
+
+    waiter_args A = { &P, 0, 10000, NULL, false };
+    pthread_t tid;
+    pthread_create(&tid, NULL, waiter, &A);
+    await_waiters(P, 1);
+
+    a->broken = true;
+    P.release(a);
+    await_waiters(P, 1); // back in line after quarantining a
+    recording_callback cb(1);
+    P.fetch_async(&cb);
+
+    double start = now();
+    check(P.maintain() == 1, "maintain() destroys the bad resource");
+    pthread_join(tid, NULL);
+    check(A.got != NULL && !A.got->broken && now() - start < 5,
+          "maintain() grows the pool for the waiting thread");
+    check(P.allocated() == 1 && P.waiting() == 1 && cb.got == NULL,
+          "callback still waiting at the high watermark");
+    P.release(A.got);
+    check(cb.got == A.got, "callback served by the next release");
+    P.release(cb.got);
+  }
+
+  // a plain fetch() doesn't take a resource while anybody is waiting
+  {
+    conn_pool P(0, 1);
+    conn *a = P.fetch();
+
+    recording_callback cb(0);
+    P.fetch_async(&cb);
+    P.raise_high_watermark(2);
+    conn *b;
+    check(P.fetch() == NULL && P.fetch_many(&b, 1) == 0 &&
+          P.allocated() == 1, "fetch() waits its turn behind waiters");
+
+    P.release(a);
+    check(cb.got == a && P.waiting() == 0, "waiter served first");
+    b = P.fetch();
+    check(b != NULL && b != a, "then fetch() can grow the pool");
+    P.release(a);
+    P.release(b);
+  }
+
+  // destroying the pool wakes up waiting threads
+  {
+    conn_pool *P = new conn_pool(0, 1);
+    conn *a = P->fetch();
+    (void)a;
+
+    waiter_args A = { P, 0, 60000, NULL, false };
+    pthread_t tid;
+    pthread_create(&tid, NULL, waiter, &A);
+    await_waiters(*P, 1);
+
+    recording_callback cb(1);
+    P->fetch_async(&cb);
+
+    double start = now();
+    delete P;
+    pthread_join(tid, NULL);
+    check(A.got == NULL && cb.got == NULL && now() - start < 5,
+          "destroying the pool releases its waiters");
+  }
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Torture test and read benchmark for seqlock and seqcount.  Writers
+  continuously store a struct whose fields must agree with each other
+  (and update a pair of counters protected by a bare seqcount), while
+  readers load it and check that they never see a torn value.  Output
+  is CSV on stdout:
+
+    readers,writers,reads,writes,seconds,reads_per_sec
+
+  $ ./seqlock [max readers] [reads per thread] > seqlock.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <krb/seqlock.hpp>
+
+struct snapshot
+{
+  uint64_t version;
+  uint32_t values[9];
+  uint64_t checksum;
+
+  void fill(uint64_t v)
+  {
+    version = v;
+    checksum = v;
+    for(uint32_t i = 0; i < 9; ++i)
+      checksum += values[i] = (uint32_t)(v * (i + 1));
+  }
+
+  bool consistent() const
+  {
+    uint64_t c = version;
+    for(uint32_t i = 0; i < 9; ++i) {
+      if(values[i] != (uint32_t)(version * (i + 1)))
+        return false;
+      c += values[i];
+    }
+    return c == checksum;
+  }
+};
+
+struct shared
+{
+  seqlock<snapshot> S;
+  seqcount pair_sc;
+  volatile uint64_t pair[2];
+  volatile bool done;
+  uint32_t reads;
+};
+
+struct writer_args
+{
+  shared *sh;
+  uint64_t base, writes;
+};
+
+void * writer(void *arg)
+{
+  writer_args *A = (writer_args *)arg;
+  snapshot s;
+
+  for(uint64_t v = A->base; !A->sh->done; ++v, ++A->writes) {
+    s.fill(v);
+    A->sh->S.store(s);
+
+    seq_write_locker W(A->sh->pair_sc);
+    store_relaxed(&A->sh->pair[0], v);
+    store_relaxed(&A->sh->pair[1], ~v);
+  }
+
+  return NULL;
+}
+
+void * reader(void *arg)
+{
+  shared *sh = (shared *)arg;
+
+  for(uint32_t i = 0; i < sh->reads; ++i) {
+    snapshot s = sh->S.load();
+    if(!s.consistent()) {
+      fprintf(stderr, "seqlock returned a torn value\n");
+      exit(1);
+    }
+
+    if(i % 16 == 0) {
+      uint64_t a, b;
+      uint32_t seq;
+      do {
+        seq = sh->pair_sc.read_begin();
+        a = load_relaxed(&sh->pair[0]);
+        b = load_relaxed(&sh->pair[1]);
+      } while(sh->pair_sc.read_retry(seq));
+      if(a != ~b) {
+        fprintf(stderr, "seqcount let a torn read through\n");
+        exit(1);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(uint32_t readers, uint32_t writers, uint32_t reads)
+{
+  shared sh;
+  snapshot s0;
+  s0.fill(0);
+  sh.S.store(s0);
+  sh.pair[0] = 0;
+  sh.pair[1] = ~(uint64_t)0;
+  sh.done = false;
+  sh.reads = reads;
+
+  std::vector<writer_args> W(writers);
+  std::vector<pthread_t> wtids(writers), rtids(readers);
+  for(uint32_t w = 0; w < writers; ++w) {
+    writer_args a = { &sh, (uint64_t)w << 40, 0 };
+    W[w] = a;
+    pthread_create(&wtids[w], NULL, writer, &W[w]);
+  }
+
+  double start = now();
+  for(uint32_t r = 0; r < readers; ++r)
+    pthread_create(&rtids[r], NULL, reader, &sh);
+  for(uint32_t r = 0; r < readers; ++r)
+    pthread_join(rtids[r], NULL);
+  double secs = now() - start;
+
+  sh.done = true;
+  uint64_t writes = 0;
+  for(uint32_t w = 0; w < writers; ++w) {
+    pthread_join(wtids[w], NULL);
+    writes += W[w].writes;
+  }
+
+  uint64_t total = (uint64_t)readers * reads;
+  printf("%u,%u,%llu,%llu,%.6f,%.1f\n", readers, writers,
+         (unsigned long long)total, (unsigned long long)writes, secs,
+         total / secs);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_readers = (argc > 1) ? atoi(argv[1]) : 8;
+  uint32_t reads = (argc > 2) ? atoi(argv[2]) : 1000000;
+
+  if(max_readers == 0 || reads == 0) {
+    fprintf(stderr, "Usage: %s [max readers] [reads per thread]\n", argv[0]);
+    return 1;
+  }
+
+  printf("readers,writers,reads,writes,seconds,reads_per_sec\n");
+  for(uint32_t r = 1; r <= max_readers; r *= 2)
+    for(uint32_t w = 1; w <= 2; ++w)
+      bench(r, w, reads);
+
+  return 0;
+}
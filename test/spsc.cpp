@@ -0,0 +1,243 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Producer/consumer test and benchmark for spsc_ring_buffer, against
+  a ring_buffer guarded by a mutex.  One thread writes a sequence of
+  32-bit counters in batches of varying size (alternating between
+  write() and write_direct_access()/write_advance()), and another
+  reads them back (alternating between read() and
+  read_direct_access()/read_advance()) and checks that nothing was
+  lost or reordered.  Output is CSV on stdout:
+
+    ring,batch,elements,seconds,elements_per_sec
+
+  $ ./spsc [elements] [ring size] > spsc.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+#include <krb/ring_buffer.hpp>
+#include <krb/spsc_ring_buffer.hpp>
+#include <krb/locker.hpp>
+
+// ring_buffer with a mutex around every call, as you'd have to use
+// it between threads
+class locked_ring
+{
+public:
+  locked_ring(uint32_t size) : R(size) { pthread_mutex_init(&mutex, NULL); }
+  ~locked_ring() { pthread_mutex_destroy(&mutex); }
+
+  bool write(const uint32_t *in, uint32_t n)
+  {
+    locker L(mutex);
+    return R.write((const char *)in, n * sizeof(uint32_t));
+  }
+
+  bool read(uint32_t *out, uint32_t n)
+  {
+    locker L(mutex);
+    return R.read((char *)out, n * sizeof(uint32_t));
+  }
+
+protected:
+  ring_buffer<char> R;
+  pthread_mutex_t mutex;
+};
+
+template <class Ring>
+struct bench_args
+{
+  Ring *ring;
+  uint32_t elements, batch;
+};
+
+// generic producer/consumer, using plain read() and write()
+template <class Ring>
+void * producer(void *arg)
+{
+  bench_args<Ring> *A = (bench_args<Ring> *)arg;
+  std::vector<uint32_t> b(A->batch);
+  uint32_t next = 0;
+
+  while(next < A->elements) {
+    uint32_t n = std::min(A->batch, A->elements - next);
+    for(uint32_t i = 0; i < n; ++i)
+      b[i] = next + i;
+    while(!A->ring->write(&b[0], n))
+      sched_yield();
+    next += n;
+  }
+
+  return NULL;
+}
+
+template <class Ring>
+void * consumer(void *arg)
+{
+  bench_args<Ring> *A = (bench_args<Ring> *)arg;
+  std::vector<uint32_t> b(A->batch);
+  uint32_t next = 0;
+
+  while(next < A->elements) {
+    uint32_t n = std::min(A->batch, A->elements - next);
+    while(!A->ring->read(&b[0], n))
+      sched_yield();
+    for(uint32_t i = 0; i < n; ++i) {
+      if(b[i] != next + i) {
+        fprintf(stderr, "expected %u, got %u\n", next + i, b[i]);
+        exit(1);
+      }
+    }
+    next += n;
+  }
+
+  return NULL;
+}
+
+// the spsc ring also gets exercised through its zero-copy interface
+template <>
+void * producer< spsc_ring_buffer<uint32_t> >(void *arg)
+{
+  bench_args< spsc_ring_buffer<uint32_t> > *A =
+    (bench_args< spsc_ring_buffer<uint32_t> > *)arg;
+  spsc_ring_buffer<uint32_t> *R = A->ring;
+  std::vector<uint32_t> b(A->batch);
+  uint32_t next = 0;
+
+  for(uint32_t round = 0; next < A->elements; ++round) {
+    uint32_t n = std::min(A->batch, A->elements - next);
+
+    if(round & 1) {
+      uint32_t m;
+      while((m = std::min(n, R->available_contiguous())) == 0)
+        sched_yield();
+      uint32_t *p = R->write_direct_access();
+      for(uint32_t i = 0; i < m; ++i)
+        p[i] = next + i;
+      R->write_advance(m);
+      next += m;
+    } else {
+      for(uint32_t i = 0; i < n; ++i)
+        b[i] = next + i;
+      while(!R->write(&b[0], n))
+        sched_yield();
+      next += n;
+    }
+  }
+
+  return NULL;
+}
+
+template <>
+void * consumer< spsc_ring_buffer<uint32_t> >(void *arg)
+{
+  bench_args< spsc_ring_buffer<uint32_t> > *A =
+    (bench_args< spsc_ring_buffer<uint32_t> > *)arg;
+  spsc_ring_buffer<uint32_t> *R = A->ring;
+  std::vector<uint32_t> b(A->batch);
+  uint32_t next = 0;
+
+  for(uint32_t round = 0; next < A->elements; ++round) {
+    uint32_t n = std::min(A->batch, A->elements - next);
+    const uint32_t *p;
+
+    if(round & 1) {
+      while(R->used_contiguous() == 0)
+        sched_yield();
+      n = std::min(n, R->used_contiguous());
+      p = R->read_direct_access();
+    } else {
+      while(!R->read(&b[0], n))
+        sched_yield();
+      p = &b[0];
+    }
+
+    for(uint32_t i = 0; i < n; ++i) {
+      if(p[i] != next + i) {
+        fprintf(stderr, "expected %u, got %u\n", next + i, p[i]);
+        exit(1);
+      }
+    }
+    if(round & 1)
+      R->read_advance(n);
+    next += n;
+  }
+
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Ring>
+void bench(const char *name, uint32_t size, uint32_t batch, uint32_t elements)
+{
+  Ring ring(size);
+  bench_args<Ring> A = { &ring, elements, batch };
+  pthread_t prod, cons;
+
+  double start = now();
+  pthread_create(&prod, NULL, producer<Ring>, &A);
+  pthread_create(&cons, NULL, consumer<Ring>, &A);
+  pthread_join(prod, NULL);
+  pthread_join(cons, NULL);
+  double secs = now() - start;
+
+  printf("%s,%u,%u,%.6f,%.1f\n", name, batch, elements, secs,
+         elements / secs);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t elements = (argc > 1) ? atoi(argv[1]) : 10000000;
+  uint32_t size = (argc > 2) ? atoi(argv[2]) : 4096;
+
+  if(elements == 0 || size < 64) {
+    fprintf(stderr, "Usage: %s [elements] [ring size >= 64]\n", argv[0]);
+    return 1;
+  }
+
+  printf("ring,batch,elements,seconds,elements_per_sec\n");
+  for(uint32_t batch = 1; batch <= 64; batch *= 4) {
+    bench<locked_ring>("ring_buffer+mutex", size * sizeof(uint32_t),
+                       batch, elements);
+    bench< spsc_ring_buffer<uint32_t> >("spsc_ring_buffer", size,
+                                        batch, elements);
+  }
+
+  return 0;
+}
@@ -24,15 +24,35 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <krb/cached_time.hpp>
 
-int main()
+int main(int argc, char **argv)
 {
-  cached_time &C = cached_time::init();
+  bool coarse = argc > 1 && strcmp(argv[1], "coarse") == 0;
+  cached_time &C = cached_time::init
+    (10, coarse ? cached_time::coarse_clock : cached_time::precise_clock);
+
+  // the cached values should never be more than an interval (plus a
+  // coarse clock tick) behind the real ones
+  for(int i = 0; i < 10; ++i) {
+    struct timeval cached, real;
+    C.gettimeofday(&cached);
+    gettimeofday(&real, NULL);
+    long behind = (real.tv_sec - cached.tv_sec) * 1000000 +
+      (real.tv_usec - cached.tv_usec);
+    printf("%s clock: cached time %ld.%06ld is %ld usec behind\n",
+           C.source() == cached_time::coarse_clock ? "coarse" : "precise",
+           (long)cached.tv_sec, (long)cached.tv_usec, behind);
+    if(behind < -10000 || behind > 50000)
+      return 1;
+    usleep(3000);
+  }
+  fflush(stdout);
 
   // to verify the caching is doing what it's supposed to, do an
-  // strace: strace ./time 2>&1 |grep -v nanosleep
+  // strace: strace -f ./time 2>&1 |grep -v nanosleep
   while(1) {
     usleep(1000);
     C.time();
@@ -0,0 +1,228 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Thread pool benchmarks.  For every resource_pool sizing policy and
+  a range of worker counts, measures:
+
+  * throughput: N empty jobs scheduled at once, jobs/sec until the
+    last callback
+  * latency: closed loop with one job in flight per worker, each
+    callback immediately scheduling the next job; schedule-to-callback
+    latency percentiles
+  * burst: 100 bursts of 4x(workers) jobs, each spinning for 20
+    microseconds, every 10ms; schedule-to-callback latency
+    percentiles
+
+  Output is CSV on stdout, one row per (benchmark, policy, workers):
+
+    benchmark,policy,workers,jobs,seconds,jobs_per_sec,
+      p50_us,p90_us,p99_us,p999_us,max_us
+
+  $ ./tpbench [max workers] [jobs] > tpbench.csv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <krb/thread_pool.hpp>
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+enum bench_mode { THROUGHPUT, LATENCY, BURST };
+
+template <class Policy> struct bench_run;
+
+template <class Policy>
+struct bench_job : public thread_pool_job
+{
+  bench_run<Policy> *R;
+  uint64_t scheduled;
+  uint64_t spin_ns;
+
+  void run()
+  {
+    if(spin_ns) {
+      uint64_t until = now_ns() + spin_ns;
+      while(now_ns() < until) {}
+    }
+  }
+
+  void callback() { R->done(this); }
+};
+
+template <class Policy>
+struct bench_run
+{
+  bench_run
+    (const char *policy_name, bench_mode m, uint32_t n_workers,
+     uint32_t n_jobs, struct event_base *ev_base)
+      : policy(policy_name), mode(m), workers(n_workers), N(n_jobs),
+        scheduled(0), finished(0), base(ev_base),
+        T(1, n_workers, ev_base), jobs(n_jobs)
+  {
+    latencies.reserve(N);
+    for(uint32_t i = 0; i < N; ++i) {
+      jobs[i].R = this;
+      jobs[i].spin_ns = (mode == BURST) ? 20000 : 0;
+    }
+  }
+
+  void schedule_next()
+  {
+    bench_job<Policy> *j = &jobs[scheduled++];
+    j->scheduled = now_ns();
+    T.schedule(j);
+  }
+
+  void done(bench_job<Policy> *j)
+  {
+    latencies.push_back((now_ns() - j->scheduled) / 1000.0);
+    if(++finished == N)
+      event_base_loopbreak(base);
+    else if(mode == LATENCY && scheduled < N)
+      schedule_next();
+  }
+
+  static void burst(int fd, short event, void *arg)
+  {
+    bench_run *R = (bench_run *)arg;
+    for(uint32_t i = 0; i < 4 * R->workers && R->scheduled < R->N; ++i)
+      R->schedule_next();
+    if(R->scheduled < R->N) {
+      struct timeval tv = { 0, 10000 };
+      evtimer_add(&R->timer, &tv);
+    }
+  }
+
+  void go()
+  {
+    start = now_ns();
+
+    switch(mode) {
+    case THROUGHPUT:
+      while(scheduled < N)
+        schedule_next();
+      break;
+    case LATENCY:
+      for(uint32_t i = 0; i < workers && scheduled < N; ++i)
+        schedule_next();
+      break;
+    case BURST:
+      evtimer_set(&timer, &bench_run::burst, this);
+      event_base_set(base, &timer);
+      burst(-1, 0, this);
+      break;
+    }
+
+    event_base_dispatch(base);
+    stop = now_ns();
+
+    if(mode == BURST)
+      evtimer_del(&timer);
+  }
+
+  double percentile(double p) const
+  {
+    return latencies[std::min((size_t)(p * latencies.size()),
+                              latencies.size() - 1)];
+  }
+
+  void report()
+  {
+    static const char *names[] = { "throughput", "latency", "burst" };
+    std::sort(latencies.begin(), latencies.end());
+    double secs = (stop - start) / 1e9;
+    printf("%s,%s,%u,%u,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+           names[mode], policy, workers, N, secs, N / secs,
+           percentile(0.5), percentile(0.9), percentile(0.99),
+           percentile(0.999), latencies.back());
+    fflush(stdout);
+  }
+
+  const char *policy;
+  bench_mode mode;
+  uint32_t workers, N, scheduled, finished;
+  struct event_base *base;
+  struct event timer;
+  uint64_t start, stop;
+  thread_pool<Policy> T;
+  std::vector< bench_job<Policy> > jobs;
+  std::vector<double> latencies;
+};
+
+template <class Policy>
+void run_suite
+  (const char *policy, uint32_t max_workers, uint32_t N,
+   struct event_base *ev_base)
+{
+  for(uint32_t w = 1; w <= max_workers; w *= 2) {
+    bench_mode modes[] = { THROUGHPUT, LATENCY, BURST };
+    for(int m = 0; m < 3; ++m) {
+      // bursts are paced, so just run 100 of them
+      uint32_t n = (modes[m] == BURST) ? std::min(N, 400 * w) : N;
+      bench_run<Policy> R(policy, modes[m], w, n, ev_base);
+      R.go();
+      R.report();
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t max_workers = (argc > 1) ? atoi(argv[1]) : 8;
+  uint32_t N = (argc > 2) ? atoi(argv[2]) : 100000;
+
+  if(max_workers == 0 || N == 0) {
+    fprintf(stderr, "Usage: %s [max workers] [jobs]\n", argv[0]);
+    return 1;
+  }
+
+  struct event_base *ev_base = (event_base *)event_init();
+
+  printf("benchmark,policy,workers,jobs,seconds,jobs_per_sec,"
+         "p50_us,p90_us,p99_us,p999_us,max_us\n");
+
+  run_suite<basic_pool_policy>
+    ("basic", max_workers, N, ev_base);
+  run_suite<never_shrink_policy>
+    ("never_shrink", max_workers, N, ev_base);
+  run_suite< fixed_growth_policy<1> >
+    ("fixed_growth_1", max_workers, N, ev_base);
+  run_suite< fixed_growth_policy<4> >
+    ("fixed_growth_4", max_workers, N, ev_base);
+  run_suite<fixed_size_policy>
+    ("fixed_size", max_workers, N, ev_base);
+
+  return 0;
+}
@@ -30,6 +30,23 @@
 #include <krb/resource_pool.hpp>
 #include <krb/thread_pool.hpp>
 
+// per-worker context; a real application would keep something like
+// a database connection here
+struct my_context : public thread_pool_context
+{
+  static int N;
+  int worker_N;
+  int jobs;
+  my_context() : worker_N(__sync_add_and_fetch(&N, 1)), jobs(0) {}
+};
+
+int my_context::N = 0;
+
+struct my_context_factory : public thread_pool_context_factory
+{
+  thread_pool_context * create() { return new my_context; }
+};
+
 struct my_job : public thread_pool_job
 {
   static int N;
@@ -38,15 +55,22 @@ struct my_job : public thread_pool_job
   resource_pool<my_job> *pool;
 
   // copy constructor is the same as the default constructor
-  my_job() { my_N = ++N; }
-  my_job(const my_job &j) { my_N = ++N; }
+  my_job() { my_N = __sync_add_and_fetch(&N, 1); }
+  my_job(const my_job &j) { my_N = __sync_add_and_fetch(&N, 1); }
 
   void run()
   {
-    printf("running job #%d\n", my_N);
     sleep(1);
   }
 
+  void run_with(thread_pool_context *ctx)
+  {
+    my_context *C = (my_context *)ctx;
+    printf("running job #%d on worker #%d (its job #%d)\n",
+           my_N, C->worker_N, ++C->jobs);
+    run();
+  }
+
   void callback()
   {
     printf("done with job #%d, finished %d jobs\n", my_N, ++done);
@@ -96,8 +120,9 @@ int main(int argc, char **argv)
 
   // create a thread pool using the event base we were given, with at
   // least one always-running thread and up to N_threads
-  // simultaneously allocated threads
-  thread_pool<> T(1, N_threads, ev_base);
+  // simultaneously allocated threads, each with its own context
+  my_context_factory factory;
+  thread_pool<> T(1, N_threads, ev_base, &factory);
 
   // schedule a bunch of jobs.  actually, the first N_threads jobs
   // will be run immediately here.  only after event_dispatch() is
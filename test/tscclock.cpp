@@ -0,0 +1,90 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Checks tsc_clock against CLOCK_MONOTONIC and measures what a
+  timestamp costs.  Prints the cost of now_ns() and clock_gettime() in
+  nanoseconds (and TSC cycles), then for a few seconds the difference
+  between the two clocks, which should stay within a few microseconds
+  as the clock recalibrates.  Fails if now_ns() ever goes backwards.
+
+  $ ./tscclock [seconds] [recalibrate ms]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <krb/tsc_clock.hpp>
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 3;
+  uint32_t recalibrate_ms = argc > 2 ? atoi(argv[2]) : 250;
+
+  tsc_clock &C = tsc_clock::init(recalibrate_ms);
+  printf("using %s, %.3f cycles/ns\n",
+         C.using_tsc() ? "TSC" : "clock_gettime", C.cycles_per_ns());
+
+  const uint32_t n = 10000000;
+  uint64_t sum = 0;
+
+  uint64_t start = tsc_clock::monotonic_ns(), c0 = tsc_clock::cycles();
+  for(uint32_t i = 0; i < n; ++i)
+    sum += C.now_ns();
+  uint64_t tsc_ns = tsc_clock::monotonic_ns() - start;
+  uint64_t tsc_cycles = tsc_clock::cycles() - c0;
+
+  start = tsc_clock::monotonic_ns();
+  c0 = tsc_clock::cycles();
+  for(uint32_t i = 0; i < n; ++i)
+    sum += tsc_clock::monotonic_ns();
+  uint64_t cgt_ns = tsc_clock::monotonic_ns() - start;
+  uint64_t cgt_cycles = tsc_clock::cycles() - c0;
+
+  printf("now_ns():        %.1f ns (%.0f cycles)\n",
+         (double)tsc_ns / n, (double)tsc_cycles / n);
+  printf("clock_gettime(): %.1f ns (%.0f cycles)\n",
+         (double)cgt_ns / n, (double)cgt_cycles / n);
+
+  uint64_t last = 0;
+  for(uint32_t i = 0; i < seconds * 5; ++i) {
+    uint64_t end = tsc_clock::monotonic_ns() + 200000000;
+    while(tsc_clock::monotonic_ns() < end) {
+      uint64_t t = C.now_ns();
+      if(t < last) {
+        fprintf(stderr, "went backwards by %llu ns\n",
+                (unsigned long long)(last - t));
+        return 1;
+      }
+      last = t;
+    }
+
+    uint64_t mono = tsc_clock::monotonic_ns(), tsc = C.now_ns();
+    printf("after %.1f s: tsc - monotonic = %lld ns\n", (i + 1) / 5.0,
+           (long long)(tsc - mono));
+  }
+
+  return sum == 42; // keep the loops from being optimized away
+}
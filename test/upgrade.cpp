@@ -0,0 +1,196 @@
+/*
+  Copyright 2008-2012 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*
+  Check-then-insert test for upgradable_rwlock.  Inserter threads look
+  a random key up in a shared map under an upgrade_locker and, if it's
+  missing, upgrade and insert it without looking again; if the upgrade
+  weren't atomic, some insert would find the key already there.
+  Reader threads do plain lookups, and an eraser thread keeps clearing
+  the map so there's always something to insert.  The same workload
+  is then run with pthread_rwlock_t and read_locker::upgrade_to_write,
+  which needs a second lookup after the upgrade; the number of times
+  that second lookup found the key is reported as "races".
+
+  $ ./upgrade [inserters] [readers] [operations per thread]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <map>
+#include <vector>
+#include <krb/upgrade_lock.hpp>
+#include <krb/locker.hpp>
+#include <krb/atomic_ops.hpp>
+
+static const uint32_t n_keys = 1024;
+
+typedef std::map<uint32_t, uint32_t> table_type;
+
+static table_type table;
+static upgradable_rwlock ur_lock;
+static pthread_rwlock_t rw_lock;
+static volatile uint32_t running;
+static volatile uint64_t inserts, races;
+
+struct thread_args
+{
+  bool upgradable;
+  uint32_t ops, seed;
+};
+
+static uint32_t next_key(uint32_t &x)
+{
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x % n_keys;
+}
+
+void * inserter(void *arg)
+{
+  thread_args *A = (thread_args *)arg;
+  uint32_t x = A->seed;
+
+  for(uint32_t i = 0; i < A->ops; ++i) {
+    uint32_t k = next_key(x);
+
+    if(A->upgradable) {
+      upgrade_locker U(ur_lock);
+      if(table.find(k) == table.end()) {
+        U.upgrade();
+        if(!table.insert(std::make_pair(k, k)).second) {
+          fprintf(stderr, "key %u appeared during an upgrade\n", k);
+          exit(1);
+        }
+        __sync_fetch_and_add(&inserts, 1);
+      }
+    } else {
+      read_locker R(rw_lock);
+      if(table.find(k) == table.end()) {
+        R.upgrade_to_write();
+        if(table.find(k) == table.end()) {
+          table.insert(std::make_pair(k, k));
+          __sync_fetch_and_add(&inserts, 1);
+        } else
+          __sync_fetch_and_add(&races, 1);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void * reader(void *arg)
+{
+  thread_args *A = (thread_args *)arg;
+  uint32_t x = A->seed;
+
+  for(uint32_t i = 0; i < A->ops; ++i) {
+    uint32_t k = next_key(x);
+    if(A->upgradable) {
+      ur_read_locker R(ur_lock);
+      table_type::const_iterator j = table.find(k);
+      if(j != table.end() && j->second != k)
+        exit(1);
+    } else {
+      read_locker R(rw_lock);
+      table_type::const_iterator j = table.find(k);
+      if(j != table.end() && j->second != k)
+        exit(1);
+    }
+  }
+
+  return NULL;
+}
+
+void * eraser(void *arg)
+{
+  thread_args *A = (thread_args *)arg;
+  while(load_acquire(&running)) {
+    if(A->upgradable) {
+      ur_write_locker W(ur_lock);
+      table.clear();
+    } else {
+      write_locker W(rw_lock);
+      table.clear();
+    }
+    sched_yield();
+  }
+  return NULL;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(bool upgradable, uint32_t n_inserters, uint32_t n_readers,
+                uint32_t ops)
+{
+  table.clear();
+  inserts = races = 0;
+  running = 1;
+
+  uint32_t n = n_inserters + n_readers;
+  std::vector<pthread_t> tids(n);
+  std::vector<thread_args> args(n);
+  pthread_t eraser_tid;
+  thread_args eraser_args = { upgradable, 0, 0 };
+
+  double start = now();
+  pthread_create(&eraser_tid, NULL, eraser, &eraser_args);
+  for(uint32_t t = 0; t < n; ++t) {
+    thread_args A = { upgradable, ops, 2463534242U + t * 7919 };
+    args[t] = A;
+    pthread_create(&tids[t], NULL, t < n_inserters ? inserter : reader,
+                   &args[t]);
+  }
+  for(uint32_t t = 0; t < n; ++t)
+    pthread_join(tids[t], NULL);
+  store_release(&running, (uint32_t)0);
+  pthread_join(eraser_tid, NULL);
+
+  printf("%-10s %llu inserts, %llu races, %.3f s\n",
+         upgradable ? "upgrade" : "rwlock", (unsigned long long)inserts,
+         (unsigned long long)races, now() - start);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t n_inserters = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t n_readers = argc > 2 ? atoi(argv[2]) : 4;
+  uint32_t ops = argc > 3 ? atoi(argv[3]) : 200000;
+
+  pthread_rwlock_init(&rw_lock, NULL);
+  run(true, n_inserters, n_readers, ops);
+  run(false, n_inserters, n_readers, ops);
+  pthread_rwlock_destroy(&rw_lock);
+  return 0;
+}